@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <utility>
+
+// Page-aligned array of T that is deliberately left uninitialized: with threaded
+// initialization, the thread that first writes a page decides which NUMA node it lands on.
+template <class T> class AlignedBuffer
+{
+  public:
+    static constexpr size_t kAlignment = 4096;
+
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(size_t size) : size_(size)
+    {
+        size_t bytes = (size * sizeof(T) + kAlignment - 1) / kAlignment * kAlignment;
+#if defined(_WIN32)
+        data_ = (T*)_aligned_malloc(bytes, kAlignment);
+#else
+        data_ = (T*)aligned_alloc(kAlignment, bytes);
+#endif
+    }
+    ~AlignedBuffer()
+    {
+#if defined(_WIN32)
+        _aligned_free(data_);
+#else
+        free(data_);
+#endif
+    }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+    AlignedBuffer(AlignedBuffer&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0))
+    {
+    }
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    T* data()
+    {
+        return data_;
+    }
+    const T* data() const
+    {
+        return data_;
+    }
+    size_t size() const
+    {
+        return size_;
+    }
+    T& operator[](size_t i)
+    {
+        return data_[i];
+    }
+    const T& operator[](size_t i) const
+    {
+        return data_[i];
+    }
+
+  private:
+    T* data_ = nullptr;
+    size_t size_ = 0;
+};
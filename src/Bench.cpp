@@ -0,0 +1,858 @@
+// Headless throughput benchmark. Steps the GPU kernel and the CPU engine for a fixed number of
+// steps over a matrix of configurations and reports MLUPS, bandwidth relative to a measured copy
+// baseline, and the spread over repeated runs.
+//
+//   cfd_bench [--steps N] [--repeats N] [--sizes 512x128,2048x512] [--backends cpu,gpu]
+//             [--layouts aos,soa] [--streaming two,inplace] [--threads 1,8,64] [--wavefront 0,8]
+//             [--precisions fp32,fp16] [--gpu-kernels global,tiled] [--sparse off,on]
+//             [--collisions bgk,trt,mrt] [--smagorinsky CS] [--ensemble K]
+//             [--lattices d3q19,d3q27] [--depth N]
+//             [--geometry shape.svg] [--accuracy STEPS] [--json results.json]
+//
+// --wavefront lists the CpuSolver::SetWavefront levels per thread the CPU runs try, 0 stepping
+// one grid sweep at a time; those runs show up as kernel +wfL.
+// --ensemble also steps K members of each size at once on the CPU (see CpuEnsemble), with tau
+// spread over [kTau, 2 kTau); its MLUPS count every member's cells.
+// --lattices also steps CpuLatticeSolver over each 3D lattice on the CPU, in every layout,
+// streaming and precision, with --depth cells along z (32 by default) and the geometry extruded
+// through them; their MLUPS count every cell of the box. They have no MRT.
+// --accuracy also runs fp16 storage next to fp32 for STEPS steps on each size and reports how far
+// the velocity and density fields drift apart.
+
+#include <glad/gl.h>
+#include <GLFW/glfw3.h>
+#pragma comment(lib, "glfw3.lib")
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "AlignedBuffer.h"
+#include "CpuEnsemble.h"
+#include "CpuFeatures.h"
+#include "CpuLattice.h"
+#include "CpuSolver.h"
+#include "Geometry.h"
+#include "GeometryImport.h"
+#include "GpuSolver.h"
+#include "Lattice.h"
+#include "ThreadPool.h"
+
+struct BenchOptions
+{
+    int steps = 200;
+    int repeats = 5;
+    std::vector<std::pair<int, int>> sizes = {{512, 128}, {1024, 256}, {2048, 512}};
+    std::vector<std::string> backends = {"cpu", "gpu"};
+    std::vector<Layout> layouts = {Layout::AoS, Layout::SoA};
+    std::vector<bool> streaming = {false, true}; // in place
+    std::vector<int> threads = {1, 0};           // 0: every hardware thread
+    std::vector<int> wavefront = {0};            // CPU levels per thread, see SetWavefront
+    std::vector<Precision> precisions = {Precision::FP32, Precision::FP16};
+    std::vector<GpuKernel> gpu_kernels = {GpuKernel::Global, GpuKernel::Tiled};
+    std::vector<bool> sparse = {false}; // GPU tile scheduling, see GpuSolver::SetSparse
+    std::vector<Collision> collisions = {Collision::BGK};
+    float smagorinsky = 0.0f; // SimParams::smagorinsky of every configuration
+    int ensemble = 0;         // Members of the CpuEnsemble runs, none when 0
+    std::vector<std::string> lattices; // CpuLatticeSolver runs
+    int depth = 32;                    // Of the 3D lattices
+    int accuracy_steps = 0;
+    const char* json_path = nullptr;
+    const char* geometry_path = nullptr; // See LoadGeometryMask, the window's wedge when null
+};
+
+struct BenchResult
+{
+    std::string backend;
+    int width;
+    int height;
+    Layout layout;
+    bool in_place;
+    const char* precision;
+    const char* collision;
+    std::string kernel;
+    int threads;
+    double mlups_mean;
+    double mlups_stddev;
+    double mlups_min;
+    double mlups_max;
+    double fluid_fraction;
+    double gbps;
+    double baseline_gbps;
+};
+
+// fp16 against fp32 after some steps, over interior fluid cells
+struct AccuracyResult
+{
+    const char* backend;
+    int width;
+    int height;
+    uint64_t step;
+    double max_du; // |u16 - u32| / U0
+    double rms_du;
+    double max_drho;
+};
+
+static std::vector<std::string> Split(const char* list)
+{
+    std::vector<std::string> items;
+    std::string item;
+    for (const char* c = list;; c++)
+    {
+        if (*c == ',' || *c == '\0')
+        {
+            if (!item.empty())
+                items.push_back(item);
+            item.clear();
+            if (*c == '\0')
+                break;
+        }
+        else
+        {
+            item += *c;
+        }
+    }
+    return items;
+}
+
+// value as a non-negative integer, false after reporting it when it is anything else
+static bool ParseCount(const char* option, const char* value, int* count)
+{
+    char* end = nullptr;
+    const long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || parsed < 0 || parsed > INT_MAX)
+    {
+        printf("Bad %s value %s, expected a non-negative integer\n", option, value);
+        return false;
+    }
+    *count = (int)parsed;
+    return true;
+}
+
+// The same for each item of a comma separated list
+static bool ParseCounts(const char* option, const char* list, std::vector<int>* counts)
+{
+    counts->clear();
+    for (const std::string& item : Split(list))
+    {
+        int count = 0;
+        if (!ParseCount(option, item.c_str(), &count))
+            return false;
+        counts->push_back(count);
+    }
+    return true;
+}
+
+// Replaces values with the value of each item of the comma separated list, false after reporting
+// an item that none of names spells
+template <class T>
+static bool SplitChoices(const char* option, const char* list,
+                         std::initializer_list<std::pair<const char*, T>> names,
+                         std::vector<T>* values)
+{
+    values->clear();
+    for (const std::string& item : Split(list))
+    {
+        auto name = std::find_if(names.begin(), names.end(),
+                                 [&](const auto& choice) { return item == choice.first; });
+        if (name == names.end())
+        {
+            printf("Unknown %s value %s\n", option, item.c_str());
+            return false;
+        }
+        values->push_back(name->second);
+    }
+    return true;
+}
+
+static bool ParseOptions(int argc, char** argv, BenchOptions* options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr)
+        {
+            printf("Missing value for %s\n", arg);
+            return false;
+        }
+        i++;
+
+        if (strcmp(arg, "--steps") == 0)
+        {
+            if (!ParseCount(arg, value, &options->steps))
+                return false;
+        }
+        else if (strcmp(arg, "--repeats") == 0)
+        {
+            if (!ParseCount(arg, value, &options->repeats))
+                return false;
+        }
+        else if (strcmp(arg, "--accuracy") == 0)
+        {
+            if (!ParseCount(arg, value, &options->accuracy_steps))
+                return false;
+        }
+        else if (strcmp(arg, "--smagorinsky") == 0)
+        {
+            char* end = nullptr;
+            options->smagorinsky = strtof(value, &end);
+            if (end == value || *end != '\0' || !(options->smagorinsky >= 0.0f))
+            {
+                printf("Bad %s value %s, expected a non-negative number\n", arg, value);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--ensemble") == 0)
+        {
+            if (!ParseCount(arg, value, &options->ensemble))
+                return false;
+        }
+        else if (strcmp(arg, "--lattices") == 0)
+        {
+            if (!SplitChoices<std::string>(
+                    arg, value, {{"d3q19", "d3q19"}, {"d3q27", "d3q27"}}, &options->lattices))
+                return false;
+        }
+        else if (strcmp(arg, "--depth") == 0)
+        {
+            if (!ParseCount(arg, value, &options->depth))
+                return false;
+        }
+        else if (strcmp(arg, "--json") == 0)
+            options->json_path = value;
+        else if (strcmp(arg, "--geometry") == 0)
+            options->geometry_path = value;
+        else if (strcmp(arg, "--backends") == 0)
+        {
+            if (!SplitChoices<std::string>(arg, value, {{"cpu", "cpu"}, {"gpu", "gpu"}},
+                                           &options->backends))
+                return false;
+        }
+        else if (strcmp(arg, "--sizes") == 0)
+        {
+            options->sizes.clear();
+            for (const std::string& size : Split(value))
+            {
+                int width = 0, height = 0;
+                if (sscanf(size.c_str(), "%dx%d", &width, &height) != 2 || width % 16 != 0 ||
+                    height % 16 != 0)
+                {
+                    printf("Bad size %s, expected WxH with multiples of 16\n", size.c_str());
+                    return false;
+                }
+                options->sizes.push_back({width, height});
+            }
+        }
+        else if (strcmp(arg, "--layouts") == 0)
+        {
+            if (!SplitChoices(arg, value, {{"aos", Layout::AoS}, {"soa", Layout::SoA}},
+                              &options->layouts))
+                return false;
+        }
+        else if (strcmp(arg, "--streaming") == 0)
+        {
+            if (!SplitChoices(arg, value, {{"two", false}, {"inplace", true}},
+                              &options->streaming))
+                return false;
+        }
+        else if (strcmp(arg, "--precisions") == 0)
+        {
+            if (!SplitChoices(arg, value, {{"fp32", Precision::FP32}, {"fp16", Precision::FP16}},
+                              &options->precisions))
+                return false;
+        }
+        else if (strcmp(arg, "--gpu-kernels") == 0)
+        {
+            if (!SplitChoices(arg, value,
+                              {{"global", GpuKernel::Global}, {"tiled", GpuKernel::Tiled}},
+                              &options->gpu_kernels))
+                return false;
+        }
+        else if (strcmp(arg, "--sparse") == 0)
+        {
+            if (!SplitChoices(arg, value, {{"off", false}, {"on", true}}, &options->sparse))
+                return false;
+        }
+        else if (strcmp(arg, "--collisions") == 0)
+        {
+            if (!SplitChoices(arg, value,
+                              {{"bgk", Collision::BGK},
+                               {"trt", Collision::TRT},
+                               {"mrt", Collision::MRT}},
+                              &options->collisions))
+                return false;
+        }
+        else if (strcmp(arg, "--threads") == 0)
+        {
+            if (!ParseCounts(arg, value, &options->threads))
+                return false;
+        }
+        else if (strcmp(arg, "--wavefront") == 0)
+        {
+            if (!ParseCounts(arg, value, &options->wavefront))
+                return false;
+        }
+        else
+        {
+            printf("Unknown option %s\n", arg);
+            return false;
+        }
+    }
+    if (!options->lattices.empty() &&
+        std::find(options->collisions.begin(), options->collisions.end(), Collision::MRT) !=
+            options->collisions.end())
+    {
+        printf("MRT is D2Q9 only, the 3D lattices of --lattices run bgk or trt\n");
+        return false;
+    }
+    return options->steps > 0 && options->repeats > 0 && options->depth >= 3;
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Read + write bandwidth of copying a buffer of the given size, best of a few runs, on the pool
+static double CpuCopyBaseline(size_t bytes, ThreadPool& pool)
+{
+    const size_t count = bytes / sizeof(float);
+    AlignedBuffer<float> src(count), dst(count);
+    const int bands = pool.NumThreads() * 16;
+    auto copy = [&](int begin, int end) {
+        size_t first = count * begin / bands;
+        size_t last = count * end / bands;
+        memcpy(dst.data() + first, src.data() + first, (last - first) * sizeof(float));
+    };
+    pool.ParallelFor(bands, [&](int begin, int end) {
+        size_t first = count * begin / bands;
+        size_t last = count * end / bands;
+        memset(src.data() + first, 0, (last - first) * sizeof(float));
+    });
+    pool.ParallelFor(bands, copy);
+
+    double best = 1e30;
+    for (int run = 0; run < 5; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        pool.ParallelFor(bands, copy);
+        best = std::min(best, Seconds(start));
+    }
+    return 2.0 * bytes / best / 1e9;
+}
+
+static double GpuCopyBaseline(size_t bytes)
+{
+    GLuint buffers[2];
+    glCreateBuffers(2, buffers);
+    glNamedBufferStorage(buffers[0], bytes, nullptr, 0);
+    glNamedBufferStorage(buffers[1], bytes, nullptr, 0);
+    glCopyNamedBufferSubData(buffers[0], buffers[1], 0, 0, bytes);
+    glFinish();
+
+    double best = 1e30;
+    for (int run = 0; run < 5; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int copy = 0; copy < 10; copy++)
+            glCopyNamedBufferSubData(buffers[0], buffers[1], 0, 0, bytes);
+        glFinish();
+        best = std::min(best, Seconds(start) / 10);
+    }
+    glDeleteBuffers(2, buffers);
+    return 2.0 * bytes / best / 1e9;
+}
+
+// Runs `step(steps)` once to warm up, then `repeats` timed times
+template <class StepFn> static std::vector<double> TimeRuns(const BenchOptions& options,
+                                                            int64_t num_cells, StepFn&& step)
+{
+    step(options.steps);
+    std::vector<double> mlups;
+    for (int run = 0; run < options.repeats; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        step(options.steps);
+        mlups.push_back((double)options.steps * num_cells / Seconds(start) / 1e6);
+    }
+    return mlups;
+}
+
+static void Summarize(const std::vector<double>& mlups, double bytes_per_update, BenchResult* r)
+{
+    double sum = 0.0;
+    for (double m : mlups)
+        sum += m;
+    r->mlups_mean = sum / mlups.size();
+    double var = 0.0;
+    for (double m : mlups)
+        var += (m - r->mlups_mean) * (m - r->mlups_mean);
+    r->mlups_stddev = mlups.size() > 1 ? sqrt(var / (mlups.size() - 1)) : 0.0;
+    r->mlups_min = *std::min_element(mlups.begin(), mlups.end());
+    r->mlups_max = *std::max_element(mlups.begin(), mlups.end());
+    r->gbps = r->mlups_mean * 1e6 * bytes_per_update / 1e9;
+}
+
+static void PrintResult(const BenchResult& r)
+{
+    printf("%-4s %5dx%-5d %-3s %-7s %-4s %-3s %-13s %3d thr  %8.1f MLUPS +-%5.1f%%  %7.1f GB/s  "
+           "%5.1f%% of copy\n",
+           r.backend.c_str(), r.width, r.height, r.layout == Layout::SoA ? "soa" : "aos",
+           r.in_place ? "inplace" : "two", r.precision, r.collision, r.kernel.c_str(), r.threads,
+           r.mlups_mean, 100.0 * r.mlups_stddev / r.mlups_mean, r.gbps,
+           100.0 * r.gbps / r.baseline_gbps);
+}
+
+static void WriteJson(const char* path, const BenchOptions& options,
+                      const std::vector<BenchResult>& results,
+                      const std::vector<AccuracyResult>& accuracy)
+{
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        printf("Cannot write %s\n", path);
+        return;
+    }
+    fprintf(file,
+            "{\n  \"steps\": %d,\n  \"repeats\": %d,\n  \"smagorinsky\": %.3f,\n  "
+            "\"results\": [\n",
+            options.steps, options.repeats, options.smagorinsky);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        fprintf(file,
+                "    {\"backend\": \"%s\", \"width\": %d, \"height\": %d, \"layout\": \"%s\", "
+                "\"streaming\": \"%s\", \"precision\": \"%s\", \"collision\": \"%s\", "
+                "\"kernel\": \"%s\", "
+                "\"threads\": %d, \"mlups_mean\": %.3f, \"mlups_stddev\": %.3f, "
+                "\"mlups_min\": %.3f, \"mlups_max\": %.3f, \"fluid_fraction\": %.4f, "
+                "\"gbps\": %.3f, \"baseline_gbps\": %.3f}%s\n",
+                r.backend.c_str(), r.width, r.height, r.layout == Layout::SoA ? "soa" : "aos",
+                r.in_place ? "inplace" : "two", r.precision, r.collision, r.kernel.c_str(),
+                r.threads, r.mlups_mean, r.mlups_stddev, r.mlups_min, r.mlups_max,
+                r.fluid_fraction, r.gbps, r.baseline_gbps, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"accuracy\": [\n");
+    for (size_t i = 0; i < accuracy.size(); i++)
+    {
+        const AccuracyResult& r = accuracy[i];
+        fprintf(file,
+                "    {\"backend\": \"%s\", \"width\": %d, \"height\": %d, \"step\": %llu, "
+                "\"max_du\": %.6g, \"rms_du\": %.6g, \"max_drho\": %.6g}%s\n",
+                r.backend, r.width, r.height, (unsigned long long)r.step, r.max_du, r.rms_du,
+                r.max_drho, i + 1 < accuracy.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+}
+
+const float kU0 = 0.075f;
+const float kTau = 3.0f * (kU0 * 128 / 100.0f) + 0.5f;
+
+// Times every backend and kernel for one grid configuration
+static void BenchConfiguration(const BenchOptions& options, const SimParams& params,
+                               const std::vector<uint32_t>& solid_cells, bool gpu_available,
+                               bool want_cpu, std::vector<BenchResult>* results)
+{
+    const PopulationLayout pop_layout(params);
+    const int64_t num_cells = (int64_t)params.width * params.height;
+    int64_t num_solid = 0;
+    for (uint32_t word : solid_cells)
+        num_solid += std::popcount(word);
+    // Every cell update reads and writes 9 populations
+    const double bytes_per_update = 2.0 * kNumVelocities * pop_layout.ElementBytes();
+
+    BenchResult result = {};
+    result.width = params.width;
+    result.height = params.height;
+    result.layout = params.layout;
+    result.in_place = params.in_place;
+    result.precision = params.precision == Precision::FP16 ? "fp16" : "fp32";
+    result.collision = CollisionName(params.collision);
+    result.fluid_fraction = (double)(num_cells - num_solid) / num_cells;
+
+    if (gpu_available)
+    {
+        std::vector<uint8_t> f_init(pop_layout.Bytes());
+        InitPopulations(f_init.data(), solid_cells.data(), params, 0, params.height);
+        GpuSolver gpu(params, solid_cells, f_init.data());
+        const double baseline_gbps = GpuCopyBaseline(pop_layout.Bytes());
+        for (GpuKernel kernel : options.gpu_kernels)
+        {
+            for (bool sparse : options.sparse)
+            {
+                gpu.SetKernel(kernel);
+                gpu.SetSparse(sparse);
+                std::vector<double> mlups = TimeRuns(options, num_cells, [&](int steps) {
+                    gpu.Step(steps);
+                    glFinish();
+                });
+                // MLUPS stay per cell of the grid, so sparse runs show the effective rate
+                result.backend = "gpu";
+                result.kernel = std::string(GpuKernelName(kernel)) + (sparse ? "+sparse" : "");
+                result.threads = 0;
+                result.baseline_gbps = baseline_gbps;
+                Summarize(mlups, bytes_per_update, &result);
+                PrintResult(result);
+                results->push_back(result);
+            }
+        }
+    }
+
+    if (!want_cpu)
+        return;
+    for (int threads : options.threads)
+    {
+        ThreadPool pool(threads);
+        CpuSolver cpu(params, solid_cells, &pool);
+        const double baseline_gbps = CpuCopyBaseline(pop_layout.Bytes(), pool);
+        for (int levels : options.wavefront)
+        {
+            // In place always steps one sweep at a time, once is enough
+            if (levels > 0 && params.in_place)
+                continue;
+            cpu.SetWavefront(levels);
+            std::vector<double> mlups =
+                TimeRuns(options, num_cells, [&](int steps) { cpu.Step(steps); });
+            // Bandwidth stays that of a sweep per step, wavefront runs show the effective rate
+            result.backend = "cpu";
+            result.kernel = SimdLevelName(cpu.GetSimdLevel());
+            if (levels > 0)
+                result.kernel += "+wf" + std::to_string(levels);
+            result.threads = pool.NumThreads();
+            result.baseline_gbps = baseline_gbps;
+            Summarize(mlups, bytes_per_update, &result);
+            PrintResult(result);
+            results->push_back(result);
+        }
+    }
+}
+
+// Times CpuEnsemble with options.ensemble members on each thread count
+static void BenchEnsemble(const BenchOptions& options, const SimParams& params,
+                          const std::vector<uint32_t>& solid_cells,
+                          std::vector<BenchResult>* results)
+{
+    std::vector<EnsembleMember> members;
+    for (int k = 0; k < options.ensemble; k++)
+        members.push_back({kU0, kTau * (1.0f + (float)k / options.ensemble)});
+    const int64_t num_cells = (int64_t)params.width * params.height;
+    int64_t num_solid = 0;
+    for (uint32_t word : solid_cells)
+        num_solid += std::popcount(word);
+
+    BenchResult result = {};
+    result.backend = "cpu";
+    result.width = params.width;
+    result.height = params.height;
+    result.layout = Layout::SoA;
+    result.in_place = false;
+    result.precision = "fp32";
+    result.collision = CollisionName(params.collision);
+    result.fluid_fraction = (double)(num_cells - num_solid) / num_cells;
+    for (int threads : options.threads)
+    {
+        ThreadPool pool(threads);
+        CpuEnsemble ensemble(params, members, solid_cells, &pool);
+        // Padding lanes are stepped too but not counted
+        const int64_t member_cells = num_cells * ensemble.NumMembers();
+        std::vector<double> mlups = TimeRuns(options, member_cells, [&](int steps) {
+            for (int step = 0; step < steps; step++)
+                ensemble.Step();
+        });
+        result.kernel = std::string(SimdLevelName(ensemble.GetSimdLevel())) + " x" +
+                        std::to_string(ensemble.NumMembers());
+        result.threads = pool.NumThreads();
+        result.baseline_gbps =
+            CpuCopyBaseline(num_cells * ensemble.NumLanes() * kNumVelocities * sizeof(float), pool);
+        Summarize(mlups, 2.0 * kNumVelocities * sizeof(float), &result);
+        PrintResult(result);
+        results->push_back(result);
+    }
+}
+
+// Times CpuLatticeSolver<L> on each thread count, the 2D solid cells repeated in every z slice
+template <class L>
+static void BenchLattice(const BenchOptions& options, const char* name, const SimParams& params,
+                         const std::vector<uint32_t>& solid_cells,
+                         std::vector<BenchResult>* results)
+{
+    const int depth = options.depth;
+    const PopulationLayout pop_layout(params, depth, L::kNumVelocities);
+    const int64_t slice_cells = (int64_t)params.width * params.height;
+    const int64_t num_cells = slice_cells * depth;
+    std::vector<uint32_t> box_cells((num_cells + 31) / 32, 0);
+    int64_t num_solid = 0;
+    for (int64_t cell = 0; cell < num_cells; cell++)
+    {
+        if (IsSolid(solid_cells.data(), (int)(cell % slice_cells)))
+        {
+            box_cells[cell / 32] |= 1u << (cell % 32);
+            num_solid++;
+        }
+    }
+
+    BenchResult result = {};
+    result.backend = "cpu";
+    result.width = params.width;
+    result.height = params.height;
+    result.layout = params.layout;
+    result.in_place = params.in_place;
+    result.precision = params.precision == Precision::FP16 ? "fp16" : "fp32";
+    result.collision = CollisionName(params.collision);
+    result.kernel = std::string(name) + " z" + std::to_string(depth);
+    result.fluid_fraction = (double)(num_cells - num_solid) / num_cells;
+    for (int threads : options.threads)
+    {
+        ThreadPool pool(threads);
+        CpuLatticeSolver<L> solver(params, depth, box_cells, &pool);
+        std::vector<double> mlups = TimeRuns(options, num_cells, [&](int steps) {
+            for (int step = 0; step < steps; step++)
+                solver.Step();
+        });
+        result.threads = pool.NumThreads();
+        result.baseline_gbps = CpuCopyBaseline(pop_layout.Bytes(), pool);
+        Summarize(mlups, 2.0 * L::kNumVelocities * pop_layout.ElementBytes(), &result);
+        PrintResult(result);
+        results->push_back(result);
+    }
+}
+
+// Velocity and density differences between two population buffers of the same grid
+static AccuracyResult CompareFields(const void* f32, const SimParams& params32, const void* f16,
+                                    const SimParams& params16, int parity,
+                                    const std::vector<uint32_t>& solid_cells)
+{
+    AccuracyResult r = {};
+    double sum_du2 = 0.0;
+    int64_t count = 0;
+    for (int y = 1; y < params32.height - 1; y++)
+    {
+        for (int x = 1; x < params32.width - 1; x++)
+        {
+            if (IsSolid(solid_cells.data(), y * params32.width + x))
+                continue;
+            float rho32, ux32, uy32, rho16, ux16, uy16;
+            CellMacroscopic(f32, params32, parity, x, y, &rho32, &ux32, &uy32);
+            CellMacroscopic(f16, params16, parity, x, y, &rho16, &ux16, &uy16);
+            double du = hypot(ux16 - ux32, uy16 - uy32) / params32.U0;
+            r.max_du = std::max(r.max_du, du);
+            r.max_drho = std::max(r.max_drho, (double)fabsf(rho16 - rho32));
+            sum_du2 += du * du;
+            count++;
+        }
+    }
+    r.rms_du = sqrt(sum_du2 / std::max<int64_t>(count, 1));
+    return r;
+}
+
+// Steps fp32 and fp16 storage side by side and compares them at 10 points along the run
+static void CompareFp16(const BenchOptions& options, const SimParams& params,
+                        const std::vector<uint32_t>& solid_cells, const char* backend,
+                        std::vector<AccuracyResult>* accuracy)
+{
+    SimParams params16 = params;
+    params16.precision = Precision::FP16;
+    const int interval = std::max(options.accuracy_steps / 10, 1);
+
+    std::unique_ptr<CpuSolver> cpu32, cpu16;
+    std::unique_ptr<GpuSolver> gpu32, gpu16;
+    std::vector<uint8_t> f32(PopulationLayout(params).Bytes());
+    std::vector<uint8_t> f16(PopulationLayout(params16).Bytes());
+    if (strcmp(backend, "gpu") == 0)
+    {
+        InitPopulations(f32.data(), solid_cells.data(), params, 0, params.height);
+        InitPopulations(f16.data(), solid_cells.data(), params16, 0, params.height);
+        gpu32 = std::make_unique<GpuSolver>(params, solid_cells, f32.data());
+        gpu16 = std::make_unique<GpuSolver>(params16, solid_cells, f16.data());
+    }
+    else
+    {
+        cpu32 = std::make_unique<CpuSolver>(params, solid_cells);
+        cpu16 = std::make_unique<CpuSolver>(params16, solid_cells);
+    }
+
+    for (int step = interval; step <= options.accuracy_steps; step += interval)
+    {
+        int parity;
+        const void* p32;
+        const void* p16;
+        if (gpu32 != nullptr)
+        {
+            gpu32->Step(interval);
+            gpu16->Step(interval);
+            glGetNamedBufferSubData(gpu32->Populations(), 0, f32.size(), f32.data());
+            glGetNamedBufferSubData(gpu16->Populations(), 0, f16.size(), f16.data());
+            parity = gpu32->Parity();
+            p32 = f32.data();
+            p16 = f16.data();
+        }
+        else
+        {
+            for (int i = 0; i < interval; i++)
+            {
+                cpu32->Step();
+                cpu16->Step();
+            }
+            parity = cpu32->Parity();
+            p32 = cpu32->Populations();
+            p16 = cpu16->Populations();
+        }
+
+        AccuracyResult r = CompareFields(p32, params, p16, params16, parity, solid_cells);
+        r.backend = backend;
+        r.width = params.width;
+        r.height = params.height;
+        r.step = step;
+        printf("%-4s %5dx%-5d fp16 vs fp32 after %6d steps: |du|/U0 max %.2e rms %.2e, "
+               "|drho| max %.2e\n",
+               backend, params.width, params.height, step, r.max_du, r.rms_du, r.max_drho);
+        accuracy->push_back(r);
+    }
+}
+
+// Hidden window, only for its GL 4.6 context
+static GLFWwindow* CreateGLContext()
+{
+    if (!glfwInit())
+        return nullptr;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "cfd_bench", nullptr, nullptr);
+    if (window == nullptr)
+        return nullptr;
+    glfwMakeContextCurrent(window);
+    if (gladLoadGL(glfwGetProcAddress) == 0)
+    {
+        glfwDestroyWindow(window);
+        return nullptr;
+    }
+    return window;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        printf("Usage: cfd_bench [--steps N] [--repeats N] [--sizes WxH,...] "
+               "[--backends cpu,gpu] [--layouts aos,soa] [--streaming two,inplace] "
+               "[--threads N,...] [--wavefront L,...] [--precisions fp32,fp16] "
+               "[--gpu-kernels global,tiled] [--sparse off,on] [--collisions bgk,trt,mrt] "
+               "[--smagorinsky CS] [--ensemble K] [--lattices d3q19,d3q27] [--depth N] "
+               "[--geometry path] [--accuracy STEPS] [--json path]\n");
+        return 1;
+    }
+
+    bool want_gpu = std::find(options.backends.begin(), options.backends.end(), "gpu") !=
+                    options.backends.end();
+    bool want_cpu = std::find(options.backends.begin(), options.backends.end(), "cpu") !=
+                    options.backends.end();
+    GLFWwindow* window = want_gpu ? CreateGLContext() : nullptr;
+    if (want_gpu && window == nullptr)
+        printf("No GL 4.6 context, skipping the GPU backend\n");
+    if (window != nullptr)
+        printf("GPU: %s\n", (const char*)glGetString(GL_RENDERER));
+    printf("CPU: %s, %u hardware threads\n", SimdLevelName(DetectSimdLevel()),
+           std::thread::hardware_concurrency());
+
+    ThreadPool setup_pool;
+    std::vector<BenchResult> results;
+    std::vector<AccuracyResult> accuracy;
+    for (auto [width, height] : options.sizes)
+    {
+        std::vector<uint32_t> solid_cells;
+        if (options.geometry_path == nullptr)
+            solid_cells = WedgeMask(width, height, setup_pool);
+        else if (!LoadGeometryMask(options.geometry_path, width, height, setup_pool, "mask_cache",
+                                   &solid_cells))
+            return 1;
+        for (Layout layout : options.layouts)
+        {
+            for (bool in_place : options.streaming)
+            {
+                for (Precision precision : options.precisions)
+                {
+                    for (Collision collision : options.collisions)
+                    {
+                        SimParams params = {width, height, kU0, kTau, layout, in_place, precision};
+                        params.collision = collision;
+                        params.smagorinsky = options.smagorinsky;
+                        BenchConfiguration(options, params, solid_cells, window != nullptr,
+                                           want_cpu, &results);
+                    }
+                }
+            }
+        }
+        if (options.ensemble > 0 && want_cpu)
+        {
+            for (Collision collision : options.collisions)
+            {
+                SimParams params = {width, height, kU0, kTau, Layout::SoA};
+                params.collision = collision;
+                params.smagorinsky = options.smagorinsky;
+                BenchEnsemble(options, params, solid_cells, &results);
+            }
+        }
+        for (const std::string& lattice : want_cpu ? options.lattices
+                                                   : std::vector<std::string>())
+        {
+            for (Layout layout : options.layouts)
+            {
+                for (bool in_place : options.streaming)
+                {
+                    for (Precision precision : options.precisions)
+                    {
+                        for (Collision collision : options.collisions)
+                        {
+                            SimParams params = {width,  height,   kU0,      kTau,
+                                                layout, in_place, precision};
+                            params.collision = collision;
+                            params.smagorinsky = options.smagorinsky;
+                            if (lattice == "d3q19")
+                                BenchLattice<D3Q19>(options, "D3Q19", params, solid_cells,
+                                                    &results);
+                            else
+                                BenchLattice<D3Q27>(options, "D3Q27", params, solid_cells,
+                                                    &results);
+                        }
+                    }
+                }
+            }
+        }
+
+        if (options.accuracy_steps > 0)
+        {
+            const SimParams params = {width, height, kU0, kTau, Layout::SoA};
+            if (want_cpu)
+                CompareFp16(options, params, solid_cells, "cpu", &accuracy);
+            if (window != nullptr)
+                CompareFp16(options, params, solid_cells, "gpu", &accuracy);
+        }
+    }
+
+    if (options.json_path != nullptr)
+        WriteJson(options.json_path, options, results, accuracy);
+
+    if (window != nullptr)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    return 0;
+}
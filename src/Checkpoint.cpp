@@ -0,0 +1,240 @@
+#include "Checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char kMagic[8] = "CFDCKPT";
+
+static uint64_t AlignUp(uint64_t offset)
+{
+    return (offset + kCheckpointAlignment - 1) / kCheckpointAlignment * kCheckpointAlignment;
+}
+
+static CheckpointHeader MakeHeader(const SimParams& params, uint64_t step_count,
+                                   size_t num_solid_words)
+{
+    const PopulationLayout layout(params);
+    CheckpointHeader header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kCheckpointVersion;
+    header.num_velocities = kNumVelocities;
+    header.width = params.width;
+    header.height = params.height;
+    header.U0 = params.U0;
+    header.tau = params.tau;
+    header.layout = (uint32_t)params.layout;
+    header.in_place = params.in_place ? 1 : 0;
+    header.precision = (uint32_t)params.precision;
+    header.collision = (uint32_t)params.collision;
+    header.step_count = step_count;
+    header.plane_stride = layout.plane_stride;
+    header.populations_offset = kCheckpointAlignment;
+    header.populations_bytes = layout.Bytes();
+    header.solid_offset = AlignUp(header.populations_offset + header.populations_bytes);
+    header.solid_bytes = num_solid_words * sizeof(uint32_t);
+    header.smagorinsky = params.smagorinsky;
+    return header;
+}
+
+// Writes bytes then zeros up to the next page boundary
+static bool WritePadded(FILE* file, const void* data, size_t bytes)
+{
+    static const uint8_t kZeros[kCheckpointAlignment] = {};
+    if (fwrite(data, 1, bytes, file) != bytes)
+        return false;
+    size_t padding = AlignUp(bytes) - bytes;
+    return fwrite(kZeros, 1, padding, file) == padding;
+}
+
+bool WriteCheckpoint(const char* path, const SimParams& params, uint64_t step_count,
+                     const void* f, const std::vector<uint32_t>& solid_cells)
+{
+    const CheckpointHeader header = MakeHeader(params, step_count, solid_cells.size());
+    // Written next to the target and renamed, a crash mid-write keeps the previous checkpoint
+    std::string temp_path = std::string(path) + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        printf("Cannot create checkpoint %s\n", temp_path.c_str());
+        return false;
+    }
+    bool ok = WritePadded(file, &header, sizeof(header)) &&
+              WritePadded(file, f, header.populations_bytes) &&
+              WritePadded(file, solid_cells.data(), header.solid_bytes);
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        printf("Cannot write checkpoint %s\n", temp_path.c_str());
+        remove(temp_path.c_str());
+        return false;
+    }
+#if defined(_WIN32)
+    ok = MoveFileExA(temp_path.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    ok = rename(temp_path.c_str(), path) == 0;
+#endif
+    if (!ok)
+        printf("Cannot replace checkpoint %s\n", path);
+    return ok;
+}
+
+bool WriteFieldSnapshot(const char* path, const SimParams& params, uint64_t step_count, int parity,
+                        const void* f)
+{
+    const int width = params.width, height = params.height;
+    const size_t num_cells = (size_t)width * height;
+    std::vector<float> fields(3 * num_cells);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const size_t cell = (size_t)y * width + x;
+            float density = 1.0f, ux = params.U0, uy = 0.0f;
+            if (parity == 0 || (x > 0 && x < width - 1 && y > 0 && y < height - 1))
+                CellMacroscopic(f, params, parity, x, y, &density, &ux, &uy);
+            fields[cell] = density;
+            fields[num_cells + cell] = ux;
+            fields[2 * num_cells + cell] = uy;
+        }
+    }
+
+    FieldSnapshotHeader header = {"CFDFLD", kFieldSnapshotVersion, width, height, params.U0,
+                                  step_count};
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        printf("Cannot create field snapshot %s\n", path);
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(fields.data(), sizeof(float), fields.size(), file) == fields.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        printf("Cannot write field snapshot %s\n", path);
+        remove(path);
+    }
+    return ok;
+}
+
+MappedCheckpoint::~MappedCheckpoint()
+{
+    Close();
+}
+
+bool MappedCheckpoint::Open(const char* path)
+{
+    Close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        printf("Cannot open checkpoint %s\n", path);
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view =
+        mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    file_ = file;
+    mapping_ = mapping;
+    size_ = (size_t)file_size.QuadPart;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+    {
+        printf("Cannot open checkpoint %s\n", path);
+        return false;
+    }
+    struct stat file_stat;
+    fstat(file, &file_stat);
+    size_ = (size_t)file_stat.st_size;
+    void* view = size_ > 0 ? mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+    close(file);
+    if (view == MAP_FAILED)
+        view = nullptr;
+#endif
+    data_ = (const uint8_t*)view;
+    if (data_ == nullptr)
+    {
+        printf("Cannot map checkpoint %s\n", path);
+        Close();
+        return false;
+    }
+
+    const CheckpointHeader& header = Header();
+    const char* error = nullptr;
+    if (size_ < sizeof(CheckpointHeader) || memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+        error = "not a checkpoint";
+    else if (header.version != kCheckpointVersion)
+        error = "unsupported version";
+    else if (header.num_velocities != kNumVelocities)
+        error = "different lattice";
+    else if (header.layout > (uint32_t)Layout::SoA ||
+             header.precision > (uint32_t)Precision::FP16 ||
+             header.collision > (uint32_t)Collision::MRT)
+        error = "unknown layout, precision or collision";
+    else if (header.populations_bytes != PopulationLayout(Params()).Bytes() ||
+             header.solid_bytes < ((size_t)header.width * header.height + 31) / 32 * 4 ||
+             header.populations_offset + header.populations_bytes > size_ ||
+             header.solid_offset + header.solid_bytes > size_)
+        error = "truncated or inconsistent sizes";
+    if (error != nullptr)
+    {
+        printf("Bad checkpoint %s: %s\n", path, error);
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedCheckpoint::Close()
+{
+#if defined(_WIN32)
+    if (data_ != nullptr)
+        UnmapViewOfFile(data_);
+    if (mapping_ != nullptr)
+        CloseHandle(mapping_);
+    if (file_ != nullptr)
+        CloseHandle(file_);
+    file_ = nullptr;
+    mapping_ = nullptr;
+#else
+    if (data_ != nullptr)
+        munmap((void*)data_, size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
+
+SimParams MappedCheckpoint::Params() const
+{
+    const CheckpointHeader& header = Header();
+    SimParams params = {header.width, header.height, header.U0, header.tau};
+    params.layout = (Layout)header.layout;
+    params.in_place = header.in_place != 0;
+    params.precision = (Precision)header.precision;
+    params.collision = (Collision)header.collision;
+    params.smagorinsky = header.smagorinsky;
+    return params;
+}
+
+std::vector<uint32_t> MappedCheckpoint::SolidCells() const
+{
+    const CheckpointHeader& header = Header();
+    const uint32_t* words = (const uint32_t*)(data_ + header.solid_offset);
+    return std::vector<uint32_t>(words, words + header.solid_bytes / sizeof(uint32_t));
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Lattice.h"
+
+// Checkpoint file: a header page, then the population buffer exactly as PopulationLayout stores
+// it (padding included) and the solid bitset, each starting on a page boundary. A mapped file
+// can be uploaded to the SSBOs or copied into the CPU engine without any repacking.
+const size_t kCheckpointAlignment = 4096;
+const uint32_t kCheckpointVersion = 2;
+
+struct CheckpointHeader
+{
+    char magic[8]; // "CFDCKPT"
+    uint32_t version;
+    uint32_t num_velocities; // Lattice, 9 for D2Q9
+    int32_t width;
+    int32_t height;
+    float U0;
+    float tau;
+    uint32_t layout; // Layout
+    uint32_t in_place;
+    uint32_t precision; // Precision
+    uint32_t collision; // Collision, zero (BGK) in checkpoints from before it existed
+    uint64_t step_count; // Steps taken, in place the populations are reversed when it is odd
+    uint64_t plane_stride;
+    uint64_t populations_offset;
+    uint64_t populations_bytes;
+    uint64_t solid_offset;
+    uint64_t solid_bytes;
+    float smagorinsky; // Zero in checkpoints from before it existed, the header page is zeroed
+};
+
+// Writes the state after step_count steps. f holds PopulationLayout(params).Bytes().
+bool WriteCheckpoint(const char* path, const SimParams& params, uint64_t step_count,
+                     const void* f, const std::vector<uint32_t>& solid_cells);
+
+// Field snapshot file: the header, then density, x velocity and y velocity as float planes of
+// width * height cells, rows from y = 0
+const uint32_t kFieldSnapshotVersion = 1;
+
+struct FieldSnapshotHeader
+{
+    char magic[8]; // "CFDFLD"
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    float U0;
+    uint64_t step_count;
+};
+
+// Writes the macroscopic fields of f, populations after step_count steps whose next step has
+// parity (see CellMacroscopic). In place with parity 1, edge cells are written at the inflow
+// state the equilibrium boundary holds them to.
+bool WriteFieldSnapshot(const char* path, const SimParams& params, uint64_t step_count, int parity,
+                        const void* f);
+
+// Read-only memory mapping of a checkpoint file
+class MappedCheckpoint
+{
+  public:
+    MappedCheckpoint() = default;
+    ~MappedCheckpoint();
+
+    MappedCheckpoint(const MappedCheckpoint&) = delete;
+    MappedCheckpoint& operator=(const MappedCheckpoint&) = delete;
+
+    // Maps path and checks its header, printing the reason on failure
+    bool Open(const char* path);
+    void Close();
+    bool IsOpen() const
+    {
+        return data_ != nullptr;
+    }
+
+    const CheckpointHeader& Header() const
+    {
+        return *(const CheckpointHeader*)data_;
+    }
+    SimParams Params() const;
+    // Populations, indexed through PopulationLayout(Params())
+    const void* Populations() const
+    {
+        return data_ + Header().populations_offset;
+    }
+    std::vector<uint32_t> SolidCells() const;
+
+  private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#if defined(_WIN32)
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
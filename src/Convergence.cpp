@@ -0,0 +1,178 @@
+#include "Convergence.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+const char* ConvergenceStateName(ConvergenceState state)
+{
+    const char* kNames[] = {"running", "steady", "averaging", "periodic"};
+    return kNames[(int)state];
+}
+
+// Weight of a new sample in the running mean of the tracked signal, before any cycle is known
+const double kLevelRate = 0.02;
+
+ConvergenceMonitor::ConvergenceMonitor(const ConvergenceCriteria& criteria, int num_channels)
+    : criteria_(criteria), num_channels_(num_channels), latest_(num_channels, 0.0f),
+      phase_sums_(num_channels, std::vector<double>(criteria.phase_bins, 0.0)),
+      phase_counts_(criteria.phase_bins, 0), channel_sums_(num_channels, 0.0)
+{
+}
+
+void ConvergenceMonitor::SetState(ConvergenceState state, uint64_t step)
+{
+    state_ = state;
+    state_step_ = step;
+}
+
+void ConvergenceMonitor::AddResidual(uint64_t step, double residual)
+{
+    last_residual_ = residual;
+    if (state_ != ConvergenceState::Running)
+        return;
+    steady_count_ = residual < criteria_.residual_tolerance ? steady_count_ + 1 : 0;
+    if (steady_count_ >= criteria_.steady_checks)
+        SetState(ConvergenceState::Steady, step);
+}
+
+void ConvergenceMonitor::AddSignal(uint64_t step, const float* values)
+{
+    if (Finished())
+        return;
+    std::copy(values, values + num_channels_, latest_.begin());
+    const float value = values[0];
+    if (!has_signal_)
+    {
+        has_signal_ = true;
+        level_ = value;
+        cycle_min_ = cycle_max_ = value;
+        last_step_ = step;
+        last_value_ = value;
+        return;
+    }
+
+    cycle_min_ = std::min(cycle_min_, value);
+    cycle_max_ = std::max(cycle_max_, value);
+    if (cycles_.empty())
+        level_ += kLevelRate * (value - level_);
+    // Hysteresis against noise around the level, a tenth of the last cycle's amplitude
+    const double band = std::max(
+        cycles_.empty() ? 0.0 : 0.1 * (cycles_.back().max - cycles_.back().min),
+        0.25 * criteria_.min_amplitude);
+    if (!above_ && value > level_ + band)
+    {
+        above_ = true;
+        // Where the signal went through the level, between the previous sample and this one
+        double t = value != last_value_ ? (level_ - last_value_) / (value - last_value_) : 1.0;
+        double crossing = last_step_ + std::clamp(t, 0.0, 1.0) * (double)(step - last_step_);
+        EndCycle(crossing, step);
+        cycle_min_ = cycle_max_ = value;
+    }
+    else if (above_ && value < level_ - band)
+    {
+        above_ = false;
+    }
+    last_step_ = step;
+    last_value_ = value;
+
+    if (state_ == ConvergenceState::Averaging)
+    {
+        // Phase from the latest upward crossing, which restarts it every cycle
+        double phase = (step - last_crossing_) / locked_period_;
+        int bin = std::min((int)(phase * criteria_.phase_bins), criteria_.phase_bins - 1);
+        for (int c = 0; c < num_channels_; c++)
+        {
+            phase_sums_[c][bin] += values[c];
+            channel_sums_[c] += values[c];
+        }
+        phase_counts_[bin]++;
+        channel_count_++;
+    }
+}
+
+void ConvergenceMonitor::EndCycle(double crossing, uint64_t step)
+{
+    const double previous = last_crossing_;
+    last_crossing_ = crossing;
+    if (previous < 0.0)
+        return;
+    cycles_.push_back({previous, crossing - previous, cycle_min_, cycle_max_});
+    level_ = 0.5 * (cycle_min_ + cycle_max_);
+
+    if (state_ == ConvergenceState::Averaging)
+    {
+        if (++averaged_cycles_ < criteria_.average_cycles)
+            return;
+        SetState(ConvergenceState::Periodic, step);
+        return;
+    }
+
+    const int n = criteria_.cycles;
+    if (state_ != ConvergenceState::Running || (int)cycles_.size() < n)
+        return;
+    double mean_period = 0.0, mean_amplitude = 0.0;
+    for (int k = (int)cycles_.size() - n; k < (int)cycles_.size(); k++)
+    {
+        mean_period += cycles_[k].period / n;
+        mean_amplitude += (cycles_[k].max - cycles_[k].min) / n;
+    }
+    if (mean_amplitude < criteria_.min_amplitude)
+        return;
+    for (int k = (int)cycles_.size() - n; k < (int)cycles_.size(); k++)
+    {
+        double amplitude = cycles_[k].max - cycles_[k].min;
+        if (fabs(cycles_[k].period - mean_period) > criteria_.period_tolerance * mean_period ||
+            fabs(amplitude - mean_amplitude) > criteria_.amplitude_tolerance * mean_amplitude)
+            return;
+    }
+
+    locked_period_ = mean_period;
+    lock_cycle_ = (int)cycles_.size();
+    SetState(criteria_.average_cycles > 0 ? ConvergenceState::Averaging
+                                          : ConvergenceState::Periodic,
+             step);
+}
+
+int ConvergenceMonitor::FirstReportedCycle() const
+{
+    if (lock_cycle_ > 0 && lock_cycle_ < (int)cycles_.size())
+        return lock_cycle_;
+    return std::max((int)cycles_.size() - criteria_.cycles, 0);
+}
+
+double ConvergenceMonitor::Period() const
+{
+    const int first = FirstReportedCycle();
+    double sum = 0.0;
+    for (int k = first; k < (int)cycles_.size(); k++)
+        sum += cycles_[k].period;
+    return first < (int)cycles_.size() ? sum / (cycles_.size() - first) : 0.0;
+}
+
+double ConvergenceMonitor::Amplitude() const
+{
+    const int first = FirstReportedCycle();
+    double sum = 0.0;
+    for (int k = first; k < (int)cycles_.size(); k++)
+        sum += cycles_[k].max - cycles_[k].min;
+    return first < (int)cycles_.size() ? sum / (cycles_.size() - first) : 0.0;
+}
+
+std::vector<double> ConvergenceMonitor::PhaseAverage(int channel) const
+{
+    std::vector<double> means(criteria_.phase_bins, 0.0);
+    for (int bin = 0; bin < criteria_.phase_bins; bin++)
+    {
+        if (phase_counts_[bin] > 0)
+            means[bin] = phase_sums_[channel][bin] / phase_counts_[bin];
+    }
+    return means;
+}
+
+double ConvergenceMonitor::Mean(int channel) const
+{
+    if (state_ == ConvergenceState::Periodic && channel_count_ > 0)
+        return channel_sums_[channel] / channel_count_;
+    return latest_[channel];
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+// When ConvergenceMonitor calls a run finished
+struct ConvergenceCriteria
+{
+    // Steps between residual samples, see VelocityResidual
+    int check_interval = 100;
+    // Steady once this many residuals in a row are below residual_tolerance
+    double residual_tolerance = 1e-6;
+    int steady_checks = 3;
+    // Periodic once the last `cycles` cycles of the tracked signal agree: each period within
+    // period_tolerance and each peak-to-peak amplitude within amplitude_tolerance of their mean,
+    // relative, and the amplitude above min_amplitude
+    int cycles = 4;
+    double period_tolerance = 0.01;
+    double amplitude_tolerance = 0.01;
+    double min_amplitude = 1e-3;
+    // Cycles phase averaged after the periodic state is found, 0 to stop right away
+    int average_cycles = 5;
+    int phase_bins = 32;
+};
+
+enum class ConvergenceState
+{
+    Running,
+    Steady,    // Finished
+    Averaging, // Periodic, collecting average_cycles more cycles
+    Periodic   // Finished, the phase averages are complete
+};
+
+const char* ConvergenceStateName(ConvergenceState state);
+
+// Decides from residual samples and a periodic signal, such as the lift coefficient or a probe's
+// velocity, when a run has nothing more to show: steady once the velocity field stops changing,
+// periodic once the tracked signal repeats its cycle. Signals are given as channels sampled at the
+// same steps; channel 0 is the tracked one and every channel is phase averaged over the cycles
+// that follow, e.g. lift then drag.
+class ConvergenceMonitor
+{
+  public:
+    ConvergenceMonitor(const ConvergenceCriteria& criteria, int num_channels);
+
+    void AddResidual(uint64_t step, double residual);
+    // values holds one value per channel, samples in increasing step order
+    void AddSignal(uint64_t step, const float* values);
+
+    ConvergenceState State() const
+    {
+        return state_;
+    }
+    bool Finished() const
+    {
+        return state_ == ConvergenceState::Steady || state_ == ConvergenceState::Periodic;
+    }
+    // Step at which the state last changed
+    uint64_t StateStep() const
+    {
+        return state_step_;
+    }
+    double LastResidual() const
+    {
+        return last_residual_;
+    }
+
+    // In steps, over the last `cycles` cycles until the periodic state is found and over the cycles
+    // since then afterwards; 0 before any cycle
+    double Period() const;
+    double Amplitude() const; // Peak to peak of channel 0
+    // Mean of channel over the averaged cycles once periodic, over the latest samples before
+    double Mean(int channel) const;
+    // phase_bins means of channel over one period, from the upward crossing of channel 0's mean,
+    // over the cycles averaged so far. 0 in bins without a sample, all of them before Averaging.
+    std::vector<double> PhaseAverage(int channel) const;
+
+  private:
+    struct Cycle
+    {
+        double start; // Step of the upward crossing, interpolated
+        double period;
+        float min;
+        float max;
+    };
+
+    // Closes the cycle that ends at crossing, found by the sample at step
+    void EndCycle(double crossing, uint64_t step);
+    void SetState(ConvergenceState state, uint64_t step);
+    // First entry of cycles_ that Period and Amplitude report on
+    int FirstReportedCycle() const;
+
+    ConvergenceCriteria criteria_;
+    int num_channels_;
+    ConvergenceState state_ = ConvergenceState::Running;
+    uint64_t state_step_ = 0;
+    double last_residual_ = 0.0;
+    int steady_count_ = 0;
+
+    // Signal tracking: level_ is a slow running mean of channel 0, above_ tells on which side of
+    // it the signal last left the hysteresis band
+    bool has_signal_ = false;
+    double level_ = 0.0;
+    bool above_ = false;
+    uint64_t last_step_ = 0;
+    float last_value_ = 0.0f;
+    double last_crossing_ = -1.0;
+    float cycle_min_ = 0.0f;
+    float cycle_max_ = 0.0f;
+    std::vector<Cycle> cycles_;
+    std::vector<float> latest_; // Last sample of every channel
+
+    // Phase averages of the Averaging state
+    int averaged_cycles_ = 0;
+    int lock_cycle_ = 0; // Size of cycles_ when the periodic state was found
+    double locked_period_ = 0.0;
+    std::vector<std::vector<double>> phase_sums_;
+    std::vector<int> phase_counts_;
+    std::vector<double> channel_sums_;
+    int64_t channel_count_ = 0;
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+// Collision operators of the CPU kernels, written once for a float (the scalar kernel) and for the
+// SIMD vector types of CpuKernelsSimd.h. Everything lives in an anonymous namespace for the same
+// reason as there: each translation unit keeps its own build for its instruction set.
+
+#include <math.h>
+
+#include <type_traits>
+#include <utility>
+
+#include "CpuKernels.h"
+
+namespace
+{
+
+template <class V> inline V Splat(float s)
+{
+    return V::Broadcast(s);
+}
+template <> inline float Splat<float>(float s)
+{
+    return s;
+}
+inline float Sqrt(float a)
+{
+    return sqrtf(a);
+}
+
+// Adds c * a to sum; c is a small lattice constant so the 0 and +-1 cases fold away
+template <class V> inline V AddScaled(V sum, V a, int c)
+{
+    if (c == 0)
+        return sum;
+    if (c == 1)
+        return sum + a;
+    if (c == -1)
+        return sum - a;
+    return sum + a * Splat<V>((float)c);
+}
+
+// Calls fn(std::integral_constant<int, k>()) for k in [0, N), unrolled, so that the lattice tables
+// are indexed with constants and the terms of zero velocity components fold away
+template <int N, class Fn> inline void Unroll(Fn&& fn)
+{
+    [&]<int... K>(std::integer_sequence<int, K...>) {
+        (fn(std::integral_constant<int, K>()), ...);
+    }(std::make_integer_sequence<int, N>());
+}
+
+// Rows of the Lallemand and Luo moment basis that MRT relaxes (energy, energy squared, x and y
+// heat flux, the two stresses), in the order of kVelocities. Density and momentum are conserved.
+// clang-format off
+const int kMrtRelaxed = 6;
+const int kMrtBasis[kMrtRelaxed][kNumVelocities] = {
+    { 2, -1,  2, -1, -4, -1,  2, -1,  2},
+    { 1, -2,  1, -2,  4, -2,  1, -2,  1},
+    {-1,  0,  1,  2,  0, -2, -1,  0,  1},
+    { 1, -2,  1,  0,  0,  0, -1,  2, -1},
+    { 0, -1,  0,  1,  0,  1,  0, -1,  0},
+    {-1,  0,  1,  0,  0,  0,  1,  0, -1}
+};
+// Squared norms of the rows, the basis is orthogonal
+const float kMrtNorms[kMrtRelaxed] = {36.0f, 36.0f, 12.0f, 12.0f, 4.0f, 4.0f};
+// clang-format on
+
+// Post-collision populations out from the streamed-in populations f, whose density and velocity
+// are given, see Collision. omega (1 / tau) may differ per lane, as it does in an ensemble.
+template <class V>
+inline void Collide(Collision collision, float smagorinsky, V omega, const V* f, V density, V ux,
+                    V uy, V* out)
+{
+    const V zero = Splat<V>(0.0f);
+    const V one = Splat<V>(1.0f);
+    const V usqr = Splat<V>(1.5f) * (ux * ux + uy * uy);
+    V feq[kNumVelocities];
+    for (int i = 0; i < kNumVelocities; i++)
+    {
+        const V cu = AddScaled(AddScaled(zero, ux, kVelocities[i][0]), uy, kVelocities[i][1]);
+        feq[i] = Splat<V>(kWeights[i]) * density *
+                 (one + Splat<V>(3.0f) * cu + Splat<V>(4.5f) * cu * cu - usqr);
+    }
+
+    if (smagorinsky > 0.0f)
+    {
+        // Smagorinsky model. The strain rate is S = -3 P / (2 rho tau) for the non-equilibrium
+        // stress P = sum_i c_i c_i (f_i - feq_i), so tau = tau0 + 3 Cs^2 |S| with
+        // |S| = sqrt(2 S:S) is a quadratic in tau
+        V pxx = zero, pyy = zero, pxy = zero;
+        for (int i = 0; i < kNumVelocities; i++)
+        {
+            const int cx = kVelocities[i][0], cy = kVelocities[i][1];
+            const V f_neq = f[i] - feq[i];
+            pxx = AddScaled(pxx, f_neq, cx * cx);
+            pyy = AddScaled(pyy, f_neq, cy * cy);
+            pxy = AddScaled(pxy, f_neq, cx * cy);
+        }
+        const V q = Sqrt(Splat<V>(2.0f) * (pxx * pxx + pyy * pyy + Splat<V>(2.0f) * pxy * pxy));
+        const V tau0 = one / omega;
+        const V c = Splat<V>(18.0f * smagorinsky * smagorinsky);
+        omega = one / (Splat<V>(0.5f) * (tau0 + Sqrt(tau0 * tau0 + c * q / density)));
+    }
+    if (collision == Collision::BGK)
+    {
+        for (int i = 0; i < kNumVelocities; i++)
+        {
+            out[i] = f[i] - (f[i] - feq[i]) * omega;
+        }
+    }
+    else if (collision == Collision::TRT)
+    {
+        const V half = Splat<V>(0.5f);
+        const V heat_flux_rate = Splat<V>(kHeatFluxRate);
+        for (int i = 0; i < kNumVelocities; i++)
+        {
+            const int j = kOpposite[i];
+            const V even = (f[i] + f[j] - feq[i] - feq[j]) * half;
+            const V odd = (f[i] - f[j] - feq[i] + feq[j]) * half;
+            out[i] = f[i] - omega * even - heat_flux_rate * odd;
+        }
+    }
+    else
+    {
+        // The equilibrium moments are those of feq, so only f - feq needs projecting
+        const V rates[kMrtRelaxed] = {Splat<V>(kMrtRateE),     Splat<V>(kMrtRateEps),
+                                      Splat<V>(kHeatFluxRate), Splat<V>(kHeatFluxRate),
+                                      omega,                   omega};
+        V f_neq[kNumVelocities];
+        for (int i = 0; i < kNumVelocities; i++)
+        {
+            f_neq[i] = f[i] - feq[i];
+            out[i] = f[i];
+        }
+        for (int k = 0; k < kMrtRelaxed; k++)
+        {
+            V moment = zero;
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                moment = AddScaled(moment, f_neq[i], kMrtBasis[k][i]);
+            }
+            moment = moment * rates[k] * Splat<V>(1.0f / kMrtNorms[k]);
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                out[i] = AddScaled(out[i], moment, -kMrtBasis[k][i]);
+            }
+        }
+    }
+}
+
+// Collide for the lattices other than D2Q9, scalar: BGK, or TRT for anything else, with the same
+// Smagorinsky tau from |P| = sqrt(P:P)
+template <class L>
+inline void CollideLattice(Collision collision, float smagorinsky, float omega, const float* f,
+                           float density, const float* u, float* out)
+{
+    constexpr int D = L::kDimensions;
+    constexpr int Q = L::kNumVelocities;
+    float feq[Q];
+    Unroll<Q>([&](auto i) { feq[i] = LatticeEquilibrium<L>(i, density, u); });
+
+    if (smagorinsky > 0.0f)
+    {
+        float p[D][D] = {};
+        Unroll<Q>([&](auto i) {
+            const float f_neq = f[i] - feq[i];
+            Unroll<D>([&](auto a) {
+                Unroll<D>([&](auto b) {
+                    const int c = L::kVelocities[i][a] * L::kVelocities[i][b];
+                    p[a][b] = AddScaled(p[a][b], f_neq, c);
+                });
+            });
+        });
+        float p2 = 0.0f;
+        Unroll<D>([&](auto a) { Unroll<D>([&](auto b) { p2 += p[a][b] * p[a][b]; }); });
+        const float q = sqrtf(2.0f * p2);
+        const float tau0 = 1.0f / omega;
+        const float c = 18.0f * smagorinsky * smagorinsky;
+        omega = 1.0f / (0.5f * (tau0 + sqrtf(tau0 * tau0 + c * q / density)));
+    }
+    if (collision == Collision::BGK)
+    {
+        Unroll<Q>([&](auto i) { out[i] = f[i] - (f[i] - feq[i]) * omega; });
+    }
+    else
+    {
+        Unroll<Q>([&](auto i) {
+            constexpr int j = L::kOpposite[i];
+            const float even = (f[i] + f[j] - feq[i] - feq[j]) * 0.5f;
+            const float odd = (f[i] - f[j] - feq[i] + feq[j]) * 0.5f;
+            out[i] = f[i] - omega * even - kHeatFluxRate * odd;
+        });
+    }
+}
+
+} // namespace
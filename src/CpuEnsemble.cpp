@@ -0,0 +1,256 @@
+#include "CpuEnsemble.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <mutex>
+
+CpuEnsemble::CpuEnsemble(const SimParams& params, const std::vector<EnsembleMember>& members,
+                         const std::vector<uint32_t>& solid_cells, ThreadPool* pool,
+                         SimdLevel level)
+    : params_(params), members_(members), solid_cells_(solid_cells), pool_(pool)
+{
+    // The ensemble layout is always "SoA" in the sense of SelectSimdLevel
+    simd_level_ = SelectSimdLevel(level, Layout::SoA);
+    kernel_ = EnsembleKernel(simd_level_);
+    const int width = EnsembleLaneWidth(simd_level_);
+    lanes_ = std::max(((int)members_.size() + width - 1) / width * width, width);
+
+    size_t num_cells = (size_t)params.width * params.height;
+    solid_cells_.resize((num_cells + 31) / 32, 0);
+    plane_stride_ = num_cells * lanes_;
+
+    omega_ = AlignedBuffer<float>(lanes_);
+    edge_feq_ = AlignedBuffer<float>(kNumVelocities * lanes_);
+    for (int k = 0; k < lanes_; k++)
+    {
+        const EnsembleMember& member = members_[std::min(k, (int)members_.size() - 1)];
+        omega_[k] = 1.0f / member.tau;
+        for (int i = 0; i < kNumVelocities; i++)
+        {
+            edge_feq_[i * lanes_ + k] = Equilibrium(i, 1.0f, member.U0, 0.0f);
+        }
+    }
+
+    // Same initial state as InitPopulations, each thread touching the bands it later steps
+    for (int b = 0; b < 2; b++)
+    {
+        f_[b] = AlignedBuffer<float>(plane_stride_ * kNumVelocities);
+        float* f = f_[b].data();
+        ForRows([&](int y_begin, int y_end) {
+            for (size_t cell = (size_t)y_begin * params_.width;
+                 cell < (size_t)y_end * params_.width; cell++)
+            {
+                const bool solid = IsSolid(solid_cells_.data(), (int)cell);
+                for (int i = 0; i < kNumVelocities; i++)
+                {
+                    float* lanes = f + i * plane_stride_ + cell * lanes_;
+                    for (int k = 0; k < lanes_; k++)
+                    {
+                        lanes[k] = solid ? kWeights[i] : edge_feq_[i * lanes_ + k];
+                    }
+                }
+            }
+        });
+    }
+}
+
+void CpuEnsemble::Step()
+{
+    EnsembleStepArgs args = {f_[current_].data(),
+                             f_[current_ ^ 1].data(),
+                             solid_cells_.data(),
+                             params_.width,
+                             params_.height,
+                             lanes_,
+                             plane_stride_,
+                             omega_.data(),
+                             edge_feq_.data(),
+                             params_.collision,
+                             params_.smagorinsky};
+    ForRows([&](int y_begin, int y_end) { kernel_(args, y_begin, y_end); });
+    current_ ^= 1;
+    step_count_++;
+}
+
+SimParams CpuEnsemble::MemberParams(int member) const
+{
+    SimParams params = params_;
+    params.U0 = members_[member].U0;
+    params.tau = members_[member].tau;
+    params.in_place = false;
+    params.precision = Precision::FP32;
+    return params;
+}
+
+void CpuEnsemble::ExtractMember(int member, void* f) const
+{
+    const PopulationLayout layout(MemberParams(member));
+    float* dst = (float*)f;
+    ForRows([&](int y_begin, int y_end) {
+        for (size_t cell = (size_t)y_begin * params_.width; cell < (size_t)y_end * params_.width;
+             cell++)
+        {
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                dst[layout.Index(cell, i)] = Lanes(i, cell)[member];
+            }
+        }
+    });
+}
+
+void CpuEnsemble::Macroscopic(int member, int x, int y, float* density, float* ux,
+                              float* uy) const
+{
+    const size_t cell = (size_t)y * params_.width + x;
+    *density = 0.0f;
+    *ux = 0.0f;
+    *uy = 0.0f;
+    for (int i = 0; i < kNumVelocities; i++)
+    {
+        float fi = Lanes(i, cell)[member];
+        *density += fi;
+        *ux += fi * kVelocities[i][0];
+        *uy += fi * kVelocities[i][1];
+    }
+    *ux /= *density;
+    *uy /= *density;
+}
+
+std::vector<MemberDiagnostics> CpuEnsemble::Diagnose() const
+{
+    const int num_members = NumMembers();
+    std::vector<MemberDiagnostics> result(num_members, MemberDiagnostics{});
+    std::mutex mutex;
+    ForRows([&](int y_begin, int y_end) {
+        std::vector<MemberDiagnostics> band(num_members, MemberDiagnostics{});
+        for (int y = y_begin; y < y_end; y++)
+        {
+            for (int x = 0; x < params_.width; x++)
+            {
+                if (IsSolid(solid_cells_.data(), y * params_.width + x))
+                    continue;
+                for (int k = 0; k < num_members; k++)
+                {
+                    float density, ux, uy;
+                    Macroscopic(k, x, y, &density, &ux, &uy);
+                    const float speed2 = ux * ux + uy * uy;
+                    MemberDiagnostics& d = band[k];
+                    // Written so that NaN fails the test
+                    if (!(density > 0.0f) || !isfinite(speed2))
+                        d.diverged = true;
+                    d.mass += density;
+                    d.kinetic_energy += 0.5 * density * speed2;
+                    d.max_speed = std::max(d.max_speed, sqrtf(speed2));
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k = 0; k < num_members; k++)
+        {
+            result[k].mass += band[k].mass;
+            result[k].kinetic_energy += band[k].kinetic_energy;
+            result[k].max_speed = std::max(result[k].max_speed, band[k].max_speed);
+            result[k].diverged = result[k].diverged || band[k].diverged;
+        }
+    });
+    return result;
+}
+
+void CpuEnsemble::Forces(float* fx, float* fy) const
+{
+    const int width = params_.width;
+    const int height = params_.height;
+    std::vector<float> sums(2 * lanes_, 0.0f);
+    std::mutex mutex;
+    ForRows([&](int y_begin, int y_end) {
+        // Every lane at once, the links are the same in all members
+        std::vector<float> band(2 * lanes_, 0.0f);
+        for (int y = std::max(y_begin, 1); y < std::min(y_end, height - 1); y++)
+        {
+            for (int x = 1; x < width - 1; x++)
+            {
+                const int cell = y * width + x;
+                if (IsSolid(solid_cells_.data(), cell))
+                    continue;
+                for (int i = 0; i < kNumVelocities; i++)
+                {
+                    const int wall = cell + kVelocities[i][1] * width + kVelocities[i][0];
+                    if (i == 4 || !IsSolid(solid_cells_.data(), wall))
+                        continue;
+                    const float* out_pops = Lanes(i, cell);
+                    const float* in_pops = Lanes(kOpposite[i], wall);
+                    for (int k = 0; k < lanes_; k++)
+                    {
+                        band[k] += kVelocities[i][0] * (out_pops[k] + in_pops[k]);
+                        band[lanes_ + k] += kVelocities[i][1] * (out_pops[k] + in_pops[k]);
+                    }
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k = 0; k < 2 * lanes_; k++)
+        {
+            sums[k] += band[k];
+        }
+    });
+    for (int k = 0; k < NumMembers(); k++)
+    {
+        fx[k] = sums[k];
+        fy[k] = sums[lanes_ + k];
+    }
+}
+
+void CpuEnsemble::Residuals(double* residuals)
+{
+    const bool first = previous_u_.size() == 0;
+    if (first)
+        previous_u_ = AlignedBuffer<float>((size_t)2 * lanes_ * params_.width * params_.height);
+    const int width = params_.width;
+    const int height = params_.height;
+    std::vector<double> sums(2 * lanes_, 0.0);
+    std::mutex mutex;
+    ForRows([&](int y_begin, int y_end) {
+        // |u - u_prev|^2 then |u|^2 of every lane
+        std::vector<double> band(2 * lanes_, 0.0);
+        for (int y = std::max(y_begin, 1); y < std::min(y_end, height - 1); y++)
+        {
+            for (int x = 1; x < width - 1; x++)
+            {
+                const size_t cell = (size_t)y * width + x;
+                if (IsSolid(solid_cells_.data(), (int)cell))
+                    continue;
+                float* previous = &previous_u_[2 * lanes_ * cell];
+                for (int k = 0; k < lanes_; k++)
+                {
+                    float density = 0.0f, ux = 0.0f, uy = 0.0f;
+                    for (int i = 0; i < kNumVelocities; i++)
+                    {
+                        const float fi = Lanes(i, cell)[k];
+                        density += fi;
+                        ux += fi * kVelocities[i][0];
+                        uy += fi * kVelocities[i][1];
+                    }
+                    ux /= density;
+                    uy /= density;
+                    const float dx = ux - previous[k], dy = uy - previous[lanes_ + k];
+                    band[k] += dx * dx + dy * dy;
+                    band[lanes_ + k] += ux * ux + uy * uy;
+                    previous[k] = ux;
+                    previous[lanes_ + k] = uy;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int k = 0; k < 2 * lanes_; k++)
+        {
+            sums[k] += band[k];
+        }
+    });
+    const uint64_t steps = first ? 0 : step_count_ - residual_step_;
+    residual_step_ = step_count_;
+    for (int k = 0; k < NumMembers(); k++)
+    {
+        residuals[k] = VelocityResidual(sums[k], sums[lanes_ + k], steps);
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "AlignedBuffer.h"
+#include "CpuKernels.h"
+#include "Lattice.h"
+#include "ThreadPool.h"
+
+// Parameters that differ between the members of an ensemble
+struct EnsembleMember
+{
+    float U0;  // Inflow velocity, see SimParams::U0
+    float tau; // Relaxation time, see SimParams::tau
+};
+
+// Diagnostics of one member, over its fluid cells
+struct MemberDiagnostics
+{
+    double mass;           // Sum of the densities
+    double kinetic_energy; // Sum of rho |u|^2 / 2
+    float max_speed;
+    bool diverged; // A density or velocity is not finite or the density is not positive
+};
+
+// Several simulations of one grid and geometry stepped together by the CPU engine. Populations
+// are stored with the member innermost, so one vector holds the same cell of consecutive
+// members: a single stream/collide pass advances all of them with one solid lookup and one set
+// of neighbor addresses per cell. Each member has its own U0 and tau; the geometry, collision
+// operator and Smagorinsky constant come from params. Always fp32 and double buffered; the
+// layout of params is only that of ExtractMember. Lanes past the last member repeat it and are
+// never reported.
+class CpuEnsemble
+{
+  public:
+    // solid_cells is the bitset of CpuSolver, pool may be null to step on the calling thread.
+    // members must not be empty. The kernel is the widest one at or below level, members are
+    // padded to its vector width.
+    CpuEnsemble(const SimParams& params, const std::vector<EnsembleMember>& members,
+                const std::vector<uint32_t>& solid_cells, ThreadPool* pool = nullptr,
+                SimdLevel level = SimdLevel::AVX512);
+
+    void Step();
+
+    int NumMembers() const
+    {
+        return (int)members_.size();
+    }
+    // Members stepped per pass, NumMembers() rounded up to the vector width
+    int NumLanes() const
+    {
+        return lanes_;
+    }
+    SimdLevel GetSimdLevel() const
+    {
+        return simd_level_;
+    }
+    uint64_t StepCount() const
+    {
+        return step_count_;
+    }
+
+    // What a CpuSolver running only this member would be given (fp32, double buffered)
+    SimParams MemberParams(int member) const;
+
+    // Copies the populations of member into f, laid out as PopulationLayout(MemberParams(member)),
+    // e.g. to write a checkpoint of it
+    void ExtractMember(int member, void* f) const;
+
+    // Density and velocity of cell (x, y) in member
+    void Macroscopic(int member, int x, int y, float* density, float* ux, float* uy) const;
+
+    // One entry per member, from a sweep over the grid on the pool
+    std::vector<MemberDiagnostics> Diagnose() const;
+
+    // Force on the obstacle in each member after the last step, see ObstacleForce; fx and fy
+    // hold NumMembers() values
+    void Forces(float* fx, float* fy) const;
+
+    // VelocityResidual of each member since the previous call, see CpuSolver::Residual;
+    // residuals holds NumMembers() values
+    void Residuals(double* residuals);
+
+  private:
+    template <class Fn> void ForRows(Fn&& fn) const
+    {
+        if (pool_ != nullptr)
+            pool_->ParallelFor(params_.height, fn);
+        else
+            fn(0, params_.height);
+    }
+
+    // Population i of cell in every lane
+    const float* Lanes(int i, size_t cell) const
+    {
+        return f_[current_].data() + i * plane_stride_ + cell * lanes_;
+    }
+
+    SimParams params_;
+    std::vector<EnsembleMember> members_;
+    std::vector<uint32_t> solid_cells_;
+    ThreadPool* pool_;
+    SimdLevel simd_level_;
+    EnsembleRowsFn kernel_;
+    int lanes_;
+    size_t plane_stride_; // num_cells * lanes_
+    AlignedBuffer<float> f_[2];
+    int current_ = 0;
+    uint64_t step_count_ = 0;
+
+    // Per lane: 1 / tau, and the equilibrium at (rho = 1, u = (U0, 0)) as [i * lanes_ + k]
+    AlignedBuffer<float> omega_;
+    AlignedBuffer<float> edge_feq_;
+
+    // Velocity fields at the last Residuals call: per cell, ux of every lane then uy
+    AlignedBuffer<float> previous_u_;
+    uint64_t residual_step_ = 0;
+};
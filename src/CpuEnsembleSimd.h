@@ -0,0 +1,108 @@
+#pragma once
+
+// Ensemble stream/collide, shared by the scalar and per-ISA translation units. V is float or the
+// vector type of CpuKernelsSimd.h; its lanes hold the same cell of consecutive members, so the
+// solid test, the edge test and all neighbor addressing are done once per cell for every lane.
+// Everything here lives in an anonymous namespace like CpuKernelsSimd.h.
+
+#include "CpuCollision.h"
+#include "CpuKernels.h"
+
+namespace
+{
+
+// Members per V
+template <class V> constexpr int kLanes = V::kWidth;
+template <> constexpr int kLanes<float> = 1;
+
+template <class V> inline V LoadLanes(const float* p)
+{
+    return V::Load(p);
+}
+template <> inline float LoadLanes<float>(const float* p)
+{
+    return *p;
+}
+template <class V> inline void StoreLanes(float* p, V a)
+{
+    V::Store(p, a);
+}
+template <> inline void StoreLanes<float>(float* p, float a)
+{
+    *p = a;
+}
+
+template <class V> void StepEnsembleRows(const EnsembleStepArgs& args, int y_begin, int y_end)
+{
+    const int width = args.width;
+    const int height = args.height;
+    const size_t lanes = args.lanes;
+    const size_t plane_stride = args.plane_stride;
+    const V zero = Splat<V>(0.0f);
+    const V one = Splat<V>(1.0f);
+
+    for (int y = y_begin; y < y_end; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const size_t cell = (size_t)y * width + x;
+            const float* f_cell = args.f_in + cell * lanes;
+            float* out_cell = args.f_out + cell * lanes;
+
+            if (IsSolid(args.solid_cells, (int)cell))
+            {
+                // Bounce-back boundary condition for solid, in every member
+                for (int i = 0; i < kNumVelocities; i++)
+                {
+                    const float* src = f_cell + i * plane_stride;
+                    float* dst = out_cell + kOpposite[i] * plane_stride;
+                    for (size_t k = 0; k < lanes; k += kLanes<V>)
+                    {
+                        StoreLanes<V>(dst + k, LoadLanes<V>(src + k));
+                    }
+                }
+                continue;
+            }
+
+            // Streaming step (pull from neighbors), equilibrium from anything outside the interior
+            const float* src[kNumVelocities];
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                int nx = x - kVelocities[i][0];
+                int ny = y - kVelocities[i][1];
+                if (nx > 0 && nx < width - 1 && ny > 0 && ny < height - 1)
+                    src[i] = args.f_in + i * plane_stride + ((size_t)ny * width + nx) * lanes;
+                else
+                    src[i] = args.edge_feq + i * lanes;
+            }
+
+            for (size_t k = 0; k < lanes; k += kLanes<V>)
+            {
+                V f[kNumVelocities];
+                V density = zero;
+                V ux = zero;
+                V uy = zero;
+                for (int i = 0; i < kNumVelocities; i++)
+                {
+                    f[i] = LoadLanes<V>(src[i] + k);
+                    density = density + f[i];
+                    ux = AddScaled(ux, f[i], kVelocities[i][0]);
+                    uy = AddScaled(uy, f[i], kVelocities[i][1]);
+                }
+                const V inv_density = one / density;
+                ux = ux * inv_density;
+                uy = uy * inv_density;
+
+                V out[kNumVelocities];
+                Collide(args.collision, args.smagorinsky, LoadLanes<V>(args.omega + k), f, density,
+                        ux, uy, out);
+                for (int i = 0; i < kNumVelocities; i++)
+                {
+                    StoreLanes<V>(out_cell + i * plane_stride + k, out[i]);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,76 @@
+#include "CpuFeatures.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void Cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#if defined(_MSC_VER)
+    __cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long Xgetbv(unsigned index)
+{
+#if defined(_MSC_VER)
+    return _xgetbv(index);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+static SimdLevel QuerySimdLevel()
+{
+    unsigned regs[4];
+    Cpuid(0, 0, regs);
+    if (regs[0] < 7)
+        return SimdLevel::Scalar;
+
+    Cpuid(1, 0, regs);
+    const bool osxsave = (regs[2] & (1u << 27)) != 0;
+    const bool avx = (regs[2] & (1u << 28)) != 0;
+    const bool fma = (regs[2] & (1u << 12)) != 0;
+    const bool f16c = (regs[2] & (1u << 29)) != 0;
+    if (!osxsave || !avx || !fma || !f16c)
+        return SimdLevel::Scalar;
+
+    // XMM/YMM state, then opmask/ZMM state, enabled by the OS
+    const unsigned long long xcr0 = Xgetbv(0);
+    if ((xcr0 & 0x6) != 0x6)
+        return SimdLevel::Scalar;
+
+    Cpuid(7, 0, regs);
+    const bool avx2 = (regs[1] & (1u << 5)) != 0;
+    const bool avx512f = (regs[1] & (1u << 16)) != 0;
+    if (avx512f && (xcr0 & 0xE0) == 0xE0)
+        return SimdLevel::AVX512;
+    if (avx2)
+        return SimdLevel::AVX2;
+    return SimdLevel::Scalar;
+}
+
+SimdLevel DetectSimdLevel()
+{
+    static const SimdLevel level = QuerySimdLevel();
+    return level;
+}
+
+const char* SimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:
+        return "AVX2";
+    case SimdLevel::AVX512:
+        return "AVX-512";
+    default:
+        return "Scalar";
+    }
+}
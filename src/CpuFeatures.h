@@ -0,0 +1,14 @@
+#pragma once
+
+// Widest instruction set the CPU engine can use on this machine
+enum class SimdLevel
+{
+    Scalar,
+    AVX2,   // AVX2 + FMA + F16C, 8 cells per instruction
+    AVX512, // AVX-512F, 16 cells per instruction
+};
+
+// Queries CPUID and XGETBV once; a level is only reported if the OS also saves its registers.
+SimdLevel DetectSimdLevel();
+
+const char* SimdLevelName(SimdLevel level);
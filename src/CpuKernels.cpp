@@ -0,0 +1,216 @@
+#include "CpuKernels.h"
+
+#include <stddef.h>
+
+#include <type_traits>
+
+#include "CpuCollision.h"
+#include "CpuEnsembleSimd.h"
+
+// Distance in cells to the neighbor along velocity i
+template <class L> static ptrdiff_t NeighborOffset(const LatticeStepArgs<L>& args, int i)
+{
+    ptrdiff_t offset = L::kVelocities[i][0] + (ptrdiff_t)L::kVelocities[i][1] * args.width;
+    if constexpr (L::kDimensions == 3)
+        offset += (ptrdiff_t)L::kVelocities[i][2] * args.width * args.height;
+    return offset;
+}
+
+// Writes the post-collision populations of cell
+template <class L, class T>
+static void StoreCell(const LatticeStepArgs<L>& args, T* f_out, size_t cell, const float* out)
+{
+    const PopulationLayout& layout = args.layout;
+    if (args.in_place && args.parity == 0)
+    {
+        Unroll<L::kNumVelocities>([&](auto i) {
+            constexpr int j = L::kOpposite[i];
+            size_t target = cell + NeighborOffset(args, i);
+            StorePopulation<L>(f_out, layout.Index(target, j), j, out[i]);
+        });
+        return;
+    }
+
+    Unroll<L::kNumVelocities>(
+        [&](auto i) { StorePopulation<L>(f_out, layout.Index(cell, i), i, out[i]); });
+}
+
+template <class L, class T>
+static void StepCells(const LatticeStepArgs<L>& args, int row, int x_begin, int x_end)
+{
+    constexpr int D = L::kDimensions;
+    constexpr int Q = L::kNumVelocities;
+    const int width = args.width;
+    const int height = args.height;
+    const int y = row % height;
+    const int z = row / height;
+    const PopulationLayout& layout = args.layout;
+    const T* f_in = (const T*)args.f_in;
+    T* f_out = (T*)args.f_out;
+    // In place (see SimParams::in_place) odd steps read the cell's own reversed slots
+    const bool read_local = args.in_place && args.parity == 1;
+    ptrdiff_t offsets[Q];
+    Unroll<Q>([&](auto i) { offsets[i] = NeighborOffset(args, i); });
+    // Where population i of cell is pulled from
+    auto source = [&](size_t cell, int i) {
+        return read_local ? layout.Index(cell, L::kOpposite[i])
+                          : layout.Index(cell - offsets[i], i);
+    };
+
+    // Rows whose neighbors along y (and z) are all inside the interior
+    bool inner_row = y > 1 && y < height - 2;
+    bool edge_row = y == 0 || y == height - 1;
+    if constexpr (D == 3)
+    {
+        inner_row = inner_row && z > 1 && z < args.depth - 2;
+        edge_row = edge_row || z == 0 || z == args.depth - 1;
+    }
+
+    for (int x = x_begin; x < x_end; x++)
+    {
+        const size_t cell = (size_t)row * width + x;
+        float out[Q];
+
+        if (args.in_place)
+        {
+            // Nothing reads the edge cells, and their push targets may lie outside the grid
+            if (edge_row || x == 0 || x == width - 1)
+                continue;
+
+            // Solid cells only ever swap their own rest state, so hand it out unchanged
+            if (IsSolid(args.solid_cells, (int)cell))
+            {
+                Unroll<Q>([&](auto i) { out[i] = L::kWeights[i]; });
+                StoreCell(args, f_out, cell, out);
+                continue;
+            }
+        }
+        else if (IsSolid(args.solid_cells, (int)cell))
+        {
+            // Bounce-back boundary condition for solid
+            Unroll<Q>([&](auto i) {
+                constexpr int j = L::kOpposite[i];
+                StorePopulation<L>(f_out, layout.Index(cell, j), j,
+                                   LoadPopulation<L>(f_in, layout.Index(cell, i), i));
+            });
+            continue;
+        }
+
+        // Streaming step (pull from neighbors), equilibrium from anything outside the interior
+        float f[Q];
+        if (inner_row && x > 1 && x < width - 2)
+        {
+            Unroll<Q>([&](auto i) {
+                const int slot = read_local ? L::kOpposite[i] : i;
+                f[i] = LoadPopulation<L>(f_in, source(cell, i), slot);
+            });
+        }
+        else
+        {
+            for (int i = 0; i < Q; i++)
+            {
+                const int nx = x - L::kVelocities[i][0];
+                const int ny = y - L::kVelocities[i][1];
+                bool interior = nx > 0 && nx < width - 1 && ny > 0 && ny < height - 1;
+                if constexpr (D == 3)
+                {
+                    const int nz = z - L::kVelocities[i][2];
+                    interior = interior && nz > 0 && nz < args.depth - 1;
+                }
+                const int slot = read_local ? L::kOpposite[i] : i;
+                f[i] = interior ? LoadPopulation<L>(f_in, source(cell, i), slot)
+                                : args.edge_feq[i];
+            }
+        }
+
+        float density = 0.0f;
+        float u[D] = {};
+        Unroll<Q>([&](auto i) {
+            density += f[i];
+            Unroll<D>([&](auto d) { u[d] = AddScaled(u[d], f[i], L::kVelocities[i][d]); });
+        });
+        Unroll<D>([&](auto d) { u[d] /= density; });
+
+        if constexpr (std::is_same_v<L, D2Q9>)
+            Collide(args.collision, args.smagorinsky, args.omega, f, density, u[0], u[1], out);
+        else
+            CollideLattice<L>(args.collision, args.smagorinsky, args.omega, f, density, u, out);
+        StoreCell(args, f_out, cell, out);
+    }
+}
+
+template <class L>
+void StepCellsScalar(const LatticeStepArgs<L>& args, int row, int x_begin, int x_end)
+{
+    if (args.layout.precision == Precision::FP16)
+        StepCells<L, uint16_t>(args, row, x_begin, x_end);
+    else
+        StepCells<L, float>(args, row, x_begin, x_end);
+}
+
+template <class L> void StepRowsScalar(const LatticeStepArgs<L>& args, int row_begin, int row_end)
+{
+    for (int row = row_begin; row < row_end; row++)
+    {
+        StepCellsScalar(args, row, 0, args.width);
+    }
+}
+
+template void StepCellsScalar(const LatticeStepArgs<D2Q9>&, int, int, int);
+template void StepCellsScalar(const LatticeStepArgs<D3Q19>&, int, int, int);
+template void StepCellsScalar(const LatticeStepArgs<D3Q27>&, int, int, int);
+template void StepRowsScalar(const LatticeStepArgs<D2Q9>&, int, int);
+template void StepRowsScalar(const LatticeStepArgs<D3Q19>&, int, int);
+template void StepRowsScalar(const LatticeStepArgs<D3Q27>&, int, int);
+
+void StepEnsembleRowsScalar(const EnsembleStepArgs& args, int y_begin, int y_end)
+{
+    StepEnsembleRows<float>(args, y_begin, y_end);
+}
+
+SimdLevel SelectSimdLevel(SimdLevel level, Layout layout)
+{
+    if (layout != Layout::SoA)
+        return SimdLevel::Scalar;
+    SimdLevel detected = DetectSimdLevel();
+    return (int)level < (int)detected ? level : detected;
+}
+
+StepRowsFn StepKernel(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:
+        return StepRowsAvx2;
+    case SimdLevel::AVX512:
+        return StepRowsAvx512;
+    default:
+        return StepRowsScalar<D2Q9>;
+    }
+}
+
+EnsembleRowsFn EnsembleKernel(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:
+        return StepEnsembleRowsAvx2;
+    case SimdLevel::AVX512:
+        return StepEnsembleRowsAvx512;
+    default:
+        return StepEnsembleRowsScalar;
+    }
+}
+
+int EnsembleLaneWidth(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:
+        return 8;
+    case SimdLevel::AVX512:
+        return 16;
+    default:
+        return 1;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "CpuFeatures.h"
+#include "Lattice.h"
+
+// Everything a stream/collide kernel of lattice L reads, for one step. The grid is depth planes
+// of height rows along x, and rows are numbered y + z * height.
+template <class L> struct LatticeStepArgs
+{
+    // float or uint16_t populations, see layout.precision
+    const void* f_in;
+    void* f_out; // Same buffer as f_in when in place
+    const uint32_t* solid_cells;
+    PopulationLayout layout;
+    int width;
+    int height;
+    int depth;   // 1 in 2D
+    float omega; // 1 / tau
+    bool in_place;
+    int parity; // Of the step being run, in place only
+    float edge_feq[L::kNumVelocities];
+    Collision collision; // BGK or TRT outside D2Q9, MRT's moment basis is D2Q9's
+    float smagorinsky;   // SimParams::smagorinsky
+};
+
+using StepArgs = LatticeStepArgs<D2Q9>;
+
+// Advances rows [y_begin, y_end) from f_in to f_out
+using StepRowsFn = void (*)(const StepArgs& args, int y_begin, int y_end);
+
+// Reference kernel, any lattice, layout and storage. Instantiated for D2Q9, D3Q19 and D3Q27.
+template <class L> void StepRowsScalar(const LatticeStepArgs<L>& args, int row_begin, int row_end);
+// Cells [x_begin, x_end) of a row, used by the SIMD kernels for the edges of the domain
+template <class L>
+void StepCellsScalar(const LatticeStepArgs<L>& args, int row, int x_begin, int x_end);
+
+// SoA only, each in a translation unit compiled for its instruction set
+void StepRowsAvx2(const StepArgs& args, int y_begin, int y_end);
+void StepRowsAvx512(const StepArgs& args, int y_begin, int y_end);
+
+// Everything an ensemble kernel reads, for one step. Populations are fp32 and stored with the
+// member innermost, f[(i * num_cells + cell) * lanes + k] (see CpuEnsemble).
+struct EnsembleStepArgs
+{
+    const float* f_in;
+    float* f_out;
+    const uint32_t* solid_cells;
+    int width;
+    int height;
+    int lanes;                // Members, padded to a multiple of the kernel's vector width
+    size_t plane_stride;      // num_cells * lanes
+    const float* omega;       // lanes values, 1 / tau of each member
+    const float* edge_feq;    // kNumVelocities * lanes, [i * lanes + k]
+    Collision collision;
+    float smagorinsky;
+};
+
+// Advances rows [y_begin, y_end) of every member from f_in to f_out
+using EnsembleRowsFn = void (*)(const EnsembleStepArgs& args, int y_begin, int y_end);
+
+void StepEnsembleRowsScalar(const EnsembleStepArgs& args, int y_begin, int y_end);
+void StepEnsembleRowsAvx2(const EnsembleStepArgs& args, int y_begin, int y_end);
+void StepEnsembleRowsAvx512(const EnsembleStepArgs& args, int y_begin, int y_end);
+
+// Widest kernel usable for the layout at or below level. The SIMD kernels need SoA.
+SimdLevel SelectSimdLevel(SimdLevel level, Layout layout);
+StepRowsFn StepKernel(SimdLevel level);
+EnsembleRowsFn EnsembleKernel(SimdLevel level);
+// Members per vector of the ensemble kernel of level
+int EnsembleLaneWidth(SimdLevel level);
@@ -0,0 +1,83 @@
+// Compiled with AVX2 + FMA enabled, only called after DetectSimdLevel()
+#include <immintrin.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace
+{
+
+struct VecAvx2
+{
+    static constexpr int kWidth = 8;
+    __m256 v;
+
+    static VecAvx2 Load(const float* p)
+    {
+        return {_mm256_loadu_ps(p)};
+    }
+    static void Store(float* p, VecAvx2 a)
+    {
+        _mm256_storeu_ps(p, a.v);
+    }
+    // Halves, converted with round to nearest even
+    static VecAvx2 LoadHalf(const uint16_t* p)
+    {
+        return {_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p))};
+    }
+    static void StoreHalf(uint16_t* p, VecAvx2 a)
+    {
+        _mm_storeu_si128((__m128i*)p, _mm256_cvtps_ph(a.v, _MM_FROUND_TO_NEAREST_INT));
+    }
+    static VecAvx2 Broadcast(float s)
+    {
+        return {_mm256_set1_ps(s)};
+    }
+    // Lane n takes a where bit n of mask is set, b elsewhere
+    static VecAvx2 Select(uint32_t mask, VecAvx2 a, VecAvx2 b)
+    {
+        const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const __m256i set = _mm256_and_si256(_mm256_set1_epi32((int)mask), lane_bits);
+        const __m256 lanes = _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, lane_bits));
+        return {_mm256_blendv_ps(b.v, a.v, lanes)};
+    }
+};
+
+inline VecAvx2 operator+(VecAvx2 a, VecAvx2 b)
+{
+    return {_mm256_add_ps(a.v, b.v)};
+}
+inline VecAvx2 operator-(VecAvx2 a, VecAvx2 b)
+{
+    return {_mm256_sub_ps(a.v, b.v)};
+}
+inline VecAvx2 operator*(VecAvx2 a, VecAvx2 b)
+{
+    return {_mm256_mul_ps(a.v, b.v)};
+}
+inline VecAvx2 operator/(VecAvx2 a, VecAvx2 b)
+{
+    return {_mm256_div_ps(a.v, b.v)};
+}
+inline VecAvx2 Sqrt(VecAvx2 a)
+{
+    return {_mm256_sqrt_ps(a.v)};
+}
+
+} // namespace
+
+#include "CpuEnsembleSimd.h"
+#include "CpuKernelsSimd.h"
+
+void StepRowsAvx2(const StepArgs& args, int y_begin, int y_end)
+{
+    if (args.layout.precision == Precision::FP16)
+        StepRowsSimd<VecAvx2, uint16_t>(args, y_begin, y_end);
+    else
+        StepRowsSimd<VecAvx2, float>(args, y_begin, y_end);
+}
+
+void StepEnsembleRowsAvx2(const EnsembleStepArgs& args, int y_begin, int y_end)
+{
+    StepEnsembleRows<VecAvx2>(args, y_begin, y_end);
+}
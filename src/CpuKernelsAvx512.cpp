@@ -0,0 +1,80 @@
+// Compiled with AVX-512F enabled, only called after DetectSimdLevel()
+#include <immintrin.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace
+{
+
+struct VecAvx512
+{
+    static constexpr int kWidth = 16;
+    __m512 v;
+
+    static VecAvx512 Load(const float* p)
+    {
+        return {_mm512_loadu_ps(p)};
+    }
+    static void Store(float* p, VecAvx512 a)
+    {
+        _mm512_storeu_ps(p, a.v);
+    }
+    // Halves, converted with round to nearest even
+    static VecAvx512 LoadHalf(const uint16_t* p)
+    {
+        return {_mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)p))};
+    }
+    static void StoreHalf(uint16_t* p, VecAvx512 a)
+    {
+        _mm256_storeu_si256((__m256i*)p, _mm512_cvtps_ph(a.v, _MM_FROUND_TO_NEAREST_INT));
+    }
+    static VecAvx512 Broadcast(float s)
+    {
+        return {_mm512_set1_ps(s)};
+    }
+    // Lane n takes a where bit n of mask is set, b elsewhere
+    static VecAvx512 Select(uint32_t mask, VecAvx512 a, VecAvx512 b)
+    {
+        return {_mm512_mask_blend_ps((__mmask16)mask, b.v, a.v)};
+    }
+};
+
+inline VecAvx512 operator+(VecAvx512 a, VecAvx512 b)
+{
+    return {_mm512_add_ps(a.v, b.v)};
+}
+inline VecAvx512 operator-(VecAvx512 a, VecAvx512 b)
+{
+    return {_mm512_sub_ps(a.v, b.v)};
+}
+inline VecAvx512 operator*(VecAvx512 a, VecAvx512 b)
+{
+    return {_mm512_mul_ps(a.v, b.v)};
+}
+inline VecAvx512 operator/(VecAvx512 a, VecAvx512 b)
+{
+    return {_mm512_div_ps(a.v, b.v)};
+}
+inline VecAvx512 Sqrt(VecAvx512 a)
+{
+    return {_mm512_sqrt_ps(a.v)};
+}
+
+} // namespace
+
+#include "CpuEnsembleSimd.h"
+#include "CpuKernelsSimd.h"
+
+void StepRowsAvx512(const StepArgs& args, int y_begin, int y_end)
+{
+    if (args.layout.precision == Precision::FP16)
+        StepRowsSimd<VecAvx512, uint16_t>(args, y_begin, y_end);
+    else
+        StepRowsSimd<VecAvx512, float>(args, y_begin, y_end);
+}
+
+void StepEnsembleRowsAvx512(const EnsembleStepArgs& args, int y_begin, int y_end)
+{
+    StepEnsembleRows<VecAvx512>(args, y_begin, y_end);
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+// Vectorized stream/collide, shared by the per-ISA translation units. Each of them defines its
+// vector type V (kWidth lanes, Load/Store, LoadHalf/StoreHalf, Broadcast/Select, arithmetic
+// operators and Sqrt) and then includes this file. Everything here lives in an anonymous
+// namespace and only calls StepCellsScalar out of line, so no function compiled for AVX can be
+// picked by the linker for scalar code.
+
+#include "CpuCollision.h"
+#include "CpuKernels.h"
+
+namespace
+{
+
+// count (<= 32) solid bits starting at cell, bit n for cell + n
+inline uint32_t SolidBits(const uint32_t* solid_cells, size_t cell, int count)
+{
+    size_t word = cell / 32;
+    uint64_t pair = solid_cells[word] | ((uint64_t)solid_cells[word + 1] << 32);
+    uint64_t bits = pair >> (cell % 32);
+    return (uint32_t)(bits & ((1ull << count) - 1));
+}
+
+// kWidth consecutive populations of plane i, for either storage type (see LoadPopulation)
+template <class V> inline V LoadPlane(const float* p, int)
+{
+    return V::Load(p);
+}
+template <class V> inline V LoadPlane(const uint16_t* p, int i)
+{
+    return V::LoadHalf(p) + V::Broadcast(kWeights[i]);
+}
+template <class V> inline void StorePlane(float* p, int, V a)
+{
+    V::Store(p, a);
+}
+template <class V> inline void StorePlane(uint16_t* p, int i, V a)
+{
+    V::StoreHalf(p, a - V::Broadcast(kWeights[i]));
+}
+
+// T is the storage type, float or uint16_t
+template <class V, class T> void StepRowsSimd(const StepArgs& args, int y_begin, int y_end)
+{
+    const int width = args.width;
+    const int height = args.height;
+    const size_t plane_stride = args.layout.plane_stride;
+    const T* f_in = (const T*)args.f_in;
+    T* f_out = (T*)args.f_out;
+
+    const V zero = V::Broadcast(0.0f);
+    const V one = V::Broadcast(1.0f);
+    const V omega = V::Broadcast(args.omega);
+
+    // In place (see SimParams::in_place) odd steps read the cell's own reversed slots and even
+    // steps push into the neighbors' reversed slots
+    const bool read_local = args.in_place && args.parity == 1;
+    const bool push = args.in_place && args.parity == 0;
+
+    for (int y = y_begin; y < y_end; y++)
+    {
+        // Vector chunks need all 9 neighbors inside the interior, i.e. x and y in [2, size - 3]
+        if (y < 2 || y > height - 3)
+        {
+            StepCellsScalar(args, y, 0, width);
+            continue;
+        }
+        StepCellsScalar(args, y, 0, 2);
+
+        int x = 2;
+        for (; x + V::kWidth <= width - 2; x += V::kWidth)
+        {
+            const size_t cell = (size_t)y * width + x;
+
+            // Streaming step (pull from neighbors)
+            V f[kNumVelocities];
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                const ptrdiff_t offset = -(ptrdiff_t)kVelocities[i][1] * width - kVelocities[i][0];
+                if (read_local)
+                    f[i] = LoadPlane<V>(f_in + kOpposite[i] * plane_stride + cell, kOpposite[i]);
+                else
+                    f[i] = LoadPlane<V>(f_in + i * plane_stride + cell + offset, i);
+            }
+
+            V density = zero;
+            V ux = zero;
+            V uy = zero;
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                density = density + f[i];
+                ux = AddScaled(ux, f[i], kVelocities[i][0]);
+                uy = AddScaled(uy, f[i], kVelocities[i][1]);
+            }
+            const V inv_density = one / density;
+            ux = ux * inv_density;
+            uy = uy * inv_density;
+
+            V out[kNumVelocities];
+            Collide(args.collision, args.smagorinsky, omega, f, density, ux, uy, out);
+
+            // Bounce-back for solid lanes: their own populations reversed, which in place is
+            // always the rest state
+            const uint32_t solid = SolidBits(args.solid_cells, cell, V::kWidth);
+            if (solid != 0)
+            {
+                for (int i = 0; i < kNumVelocities; i++)
+                {
+                    const V reversed =
+                        args.in_place
+                            ? V::Broadcast(kWeights[i])
+                            : LoadPlane<V>(f_in + kOpposite[i] * plane_stride + cell, kOpposite[i]);
+                    out[i] = V::Select(solid, reversed, out[i]);
+                }
+            }
+
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                if (push)
+                {
+                    const ptrdiff_t offset =
+                        (ptrdiff_t)kVelocities[i][1] * width + kVelocities[i][0];
+                    StorePlane<V>(f_out + kOpposite[i] * plane_stride + cell + offset, kOpposite[i],
+                                  out[i]);
+                }
+                else
+                {
+                    StorePlane<V>(f_out + i * plane_stride + cell, i, out[i]);
+                }
+            }
+        }
+
+        StepCellsScalar(args, y, x, width);
+    }
+}
+
+} // namespace
@@ -0,0 +1,81 @@
+#include "CpuLattice.h"
+
+template <class L>
+CpuLatticeSolver<L>::CpuLatticeSolver(const SimParams& params, int depth,
+                                      const std::vector<uint32_t>& solid_cells, ThreadPool* pool)
+    : params_(params), depth_(depth), layout_(params, depth, L::kNumVelocities),
+      solid_cells_(solid_cells), pool_(pool)
+{
+    solid_cells_.resize((layout_.num_cells + 31) / 32, 0);
+    for (int i = 0; i < (params.in_place ? 1 : 2); i++)
+    {
+        f_[i] = AlignedBuffer<uint8_t>(layout_.Bytes());
+        uint8_t* f = f_[i].data();
+        ForRows([&](int row_begin, int row_end) {
+            InitLatticePopulations<L>(f, solid_cells_.data(), params_, depth_, row_begin, row_end);
+        });
+    }
+    const float u[3] = {params.U0, 0.0f, 0.0f};
+    for (int i = 0; i < L::kNumVelocities; i++)
+    {
+        edge_feq_[i] = LatticeEquilibrium<L>(i, 1.0f, u);
+    }
+}
+
+template <class L> void CpuLatticeSolver<L>::Step()
+{
+    uint8_t* f_out = params_.in_place ? f_[current_].data() : f_[current_ ^ 1].data();
+    LatticeStepArgs<L> args = {.f_in = f_[current_].data(),
+                               .f_out = f_out,
+                               .solid_cells = solid_cells_.data(),
+                               .layout = layout_,
+                               .width = params_.width,
+                               .height = params_.height,
+                               .depth = depth_,
+                               .omega = 1.0f / params_.tau,
+                               .in_place = params_.in_place,
+                               .parity = Parity(),
+                               .edge_feq = {},
+                               .collision = params_.collision,
+                               .smagorinsky = params_.smagorinsky};
+    for (int i = 0; i < L::kNumVelocities; i++)
+    {
+        args.edge_feq[i] = edge_feq_[i];
+    }
+    ForRows([&](int row_begin, int row_end) { StepRowsScalar(args, row_begin, row_end); });
+    if (!params_.in_place)
+        current_ ^= 1;
+    step_count_++;
+}
+
+template <class L>
+void CpuLatticeSolver<L>::Macroscopic(int x, int y, int z, float* density, float* u) const
+{
+    const size_t cell = ((size_t)z * params_.height + y) * params_.width + x;
+    const bool fp16 = layout_.precision == Precision::FP16;
+    *density = 0.0f;
+    u[0] = u[1] = u[2] = 0.0f;
+    for (int i = 0; i < L::kNumVelocities; i++)
+    {
+        size_t index = layout_.Index(cell, i);
+        int slot = i;
+        if (Parity() == 1)
+        {
+            // Pushed into the neighbor's opposite slot by the last (even) step, see CellMacroscopic
+            const auto& c = L::kVelocities[i];
+            slot = L::kOpposite[i];
+            index = layout_.Index(
+                cell + ((ptrdiff_t)c[2] * params_.height + c[1]) * params_.width + c[0], slot);
+        }
+        const float fi = fp16 ? LoadPopulation<L>((const uint16_t*)Populations(), index, slot)
+                              : LoadPopulation<L>((const float*)Populations(), index, slot);
+        *density += fi;
+        for (int d = 0; d < 3; d++)
+            u[d] += fi * L::kVelocities[i][d];
+    }
+    for (int d = 0; d < 3; d++)
+        u[d] /= *density;
+}
+
+template class CpuLatticeSolver<D3Q19>;
+template class CpuLatticeSolver<D3Q27>;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "AlignedBuffer.h"
+#include "CpuKernels.h"
+#include "Lattice.h"
+#include "LatticeModel.h"
+#include "ThreadPool.h"
+
+// 3D engine over D3Q19 or D3Q27: CpuSolver's scalar kernel, StepRowsScalar<L>, stepped over depth
+// planes of the 2D grid. Same pull streaming, equilibrium at (rho = 1, u = (U0, 0, 0)) streamed in
+// from the domain faces and bounce-back, in the layout, storage and streaming of params, but
+// without SIMD kernels, forces or residuals. The collision is BGK or TRT, MRT is D2Q9 only.
+template <class L> class CpuLatticeSolver
+{
+    static_assert(L::kDimensions == 3, "D2Q9 runs on CpuSolver");
+
+  public:
+    // solid_cells has one bit per cell, x fastest then y then z. pool may be null to step on the
+    // calling thread, otherwise it must outlive the solver.
+    CpuLatticeSolver(const SimParams& params, int depth, const std::vector<uint32_t>& solid_cells,
+                     ThreadPool* pool = nullptr);
+
+    void Step();
+
+    // Density and velocity (3 components) of cell (x, y, z); in place, only valid away from the
+    // domain faces
+    void Macroscopic(int x, int y, int z, float* density, float* u) const;
+
+    // Populations after the last step, indexed through PopLayout(), see CpuSolver::Populations
+    const void* Populations() const
+    {
+        return f_[current_].data();
+    }
+    const PopulationLayout& PopLayout() const
+    {
+        return layout_;
+    }
+    int Depth() const
+    {
+        return depth_;
+    }
+    uint64_t StepCount() const
+    {
+        return step_count_;
+    }
+    // Parity of the next step, see CpuSolver::Parity
+    int Parity() const
+    {
+        return params_.in_place ? (int)(step_count_ & 1) : 0;
+    }
+
+  private:
+    // Runs fn(row_begin, row_end) over the height * depth rows, see LatticeStepArgs
+    template <class Fn> void ForRows(Fn&& fn) const
+    {
+        if (pool_ != nullptr)
+            pool_->ParallelFor(params_.height * depth_, fn);
+        else
+            fn(0, params_.height * depth_);
+    }
+
+    SimParams params_;
+    int depth_;
+    PopulationLayout layout_;
+    std::vector<uint32_t> solid_cells_;
+    ThreadPool* pool_;
+    AlignedBuffer<uint8_t> f_[2];
+    int current_ = 0;
+    uint64_t step_count_ = 0;
+    float edge_feq_[L::kNumVelocities];
+};
+
+extern template class CpuLatticeSolver<D3Q19>;
+extern template class CpuLatticeSolver<D3Q27>;
@@ -0,0 +1,219 @@
+#include "CpuSolver.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+CpuSolver::CpuSolver(const SimParams& params, const std::vector<uint32_t>& solid_cells,
+                     ThreadPool* pool)
+    : params_(params), layout_(params), solid_cells_(solid_cells), pool_(pool)
+{
+    size_t num_cells = (size_t)params.width * params.height;
+    solid_cells_.resize((num_cells + 31) / 32, 0);
+    for (int i = 0; i < (params.in_place ? 1 : 2); i++)
+    {
+        f_[i] = AlignedBuffer<uint8_t>(layout_.Bytes());
+        uint8_t* f = f_[i].data();
+        ForRows([&](int y_begin, int y_end) {
+            InitPopulations(f, solid_cells_.data(), params_, y_begin, y_end);
+        });
+    }
+    for (int i = 0; i < kNumVelocities; i++)
+    {
+        edge_feq_[i] = Equilibrium(i, 1.0f, params.U0, 0.0f);
+    }
+    SetSimdLevel(SimdLevel::AVX512);
+}
+
+void CpuSolver::SetSimdLevel(SimdLevel level)
+{
+    simd_level_ = SelectSimdLevel(level, params_.layout);
+    kernel_ = StepKernel(simd_level_);
+}
+
+StepArgs CpuSolver::MakeStepArgs(const void* f_in, void* f_out) const
+{
+    StepArgs args = {.f_in = f_in,
+                     .f_out = f_out,
+                     .solid_cells = solid_cells_.data(),
+                     .layout = layout_,
+                     .width = params_.width,
+                     .height = params_.height,
+                     .depth = 1,
+                     .omega = 1.0f / params_.tau,
+                     .in_place = params_.in_place,
+                     .parity = Parity(),
+                     .edge_feq = {},
+                     .collision = params_.collision,
+                     .smagorinsky = params_.smagorinsky};
+    for (int i = 0; i < kNumVelocities; i++)
+    {
+        args.edge_feq[i] = edge_feq_[i];
+    }
+    return args;
+}
+
+void CpuSolver::Step()
+{
+    uint8_t* f_out = params_.in_place ? f_[current_].data() : f_[current_ ^ 1].data();
+    const StepArgs args = MakeStepArgs(f_[current_].data(), f_out);
+    ForRows([&](int y_begin, int y_end) { kernel_(args, y_begin, y_end); });
+    if (!params_.in_place)
+        current_ ^= 1;
+    step_count_++;
+}
+
+void CpuSolver::Step(int count)
+{
+    if (wavefront_levels_ <= 0 || params_.in_place)
+    {
+        for (int step = 0; step < count; step++)
+            Step();
+        return;
+    }
+    const int num_threads = pool_ != nullptr ? pool_->NumThreads() : 1;
+    while (count > 0)
+    {
+        const int levels = std::min(count, num_threads * wavefront_levels_);
+        StepWavefront(levels, (levels + wavefront_levels_ - 1) / wavefront_levels_);
+        count -= levels;
+    }
+}
+
+void CpuSolver::StepWavefront(int levels, int num_stages)
+{
+    // Level k reads buffer (current_ + k) & 1 and writes the other one
+    const StepArgs args[2] = {MakeStepArgs(f_[current_].data(), f_[current_ ^ 1].data()),
+                              MakeStepArgs(f_[current_ ^ 1].data(), f_[current_].data())};
+    if (stage_progress_ == nullptr)
+        stage_progress_.reset(new StageProgress[pool_ != nullptr ? pool_->NumThreads() : 1]);
+    for (int stage = 0; stage < num_stages; stage++)
+        stage_progress_[stage].positions.store(0, std::memory_order_relaxed);
+
+    const int height = params_.height;
+    auto first_level = [&](int stage) { return stage * levels / num_stages; };
+    auto run_stage = [&](int stage) {
+        const int first = first_level(stage);
+        const int count = first_level(stage + 1) - first;
+        const int positions = height + count - 1;
+        const int previous_count = stage > 0 ? first - first_level(stage - 1) : 0;
+        for (int w = 0; w < positions; w++)
+        {
+            // Row w of this stage's first level pulls from row w + 1 of the previous stage's
+            // last level, which that stage steps at position w + previous_count. Waiting for it
+            // also keeps this stage from overwriting the rows two levels back before the
+            // previous stage has read them.
+            if (stage > 0)
+            {
+                const int needed = std::min(w + previous_count + 1, height + previous_count - 1);
+                const StageProgress& previous = stage_progress_[stage - 1];
+                while (previous.positions.load(std::memory_order_acquire) < needed)
+                    std::this_thread::yield();
+            }
+            // Level first + k is k rows behind the first one, after the rows it reads
+            for (int k = 0; k < count; k++)
+            {
+                const int y = w - k;
+                if (y >= 0 && y < height)
+                    kernel_(args[(first + k) & 1], y, y + 1);
+            }
+            stage_progress_[stage].positions.store(w + 1, std::memory_order_release);
+        }
+    };
+    // One stage per band, each thread starting on its own
+    if (pool_ != nullptr)
+    {
+        pool_->ParallelFor(num_stages, [&](int begin, int end) {
+            for (int stage = begin; stage < end; stage++)
+                run_stage(stage);
+        });
+    }
+    else
+    {
+        run_stage(0);
+    }
+    current_ ^= levels & 1;
+    step_count_ += levels;
+}
+
+void CpuSolver::Restore(const void* f, uint64_t step_count)
+{
+    uint8_t* dst = f_[current_].data();
+    const uint8_t* src = (const uint8_t*)f;
+    const size_t element_bytes = layout_.ElementBytes();
+    ForRows([&](int y_begin, int y_end) {
+        size_t first = (size_t)y_begin * params_.width;
+        size_t count = (size_t)(y_end - y_begin) * params_.width;
+        if (layout_.layout == Layout::SoA)
+        {
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                size_t offset = layout_.Index(first, i) * element_bytes;
+                memcpy(dst + offset, src + offset, count * element_bytes);
+            }
+        }
+        else
+        {
+            size_t offset = layout_.Index(first, 0) * element_bytes;
+            memcpy(dst + offset, src + offset, count * kNumVelocities * element_bytes);
+        }
+    });
+    step_count_ = step_count;
+}
+
+void CpuSolver::Macroscopic(int x, int y, float* density, float* ux, float* uy) const
+{
+    CellMacroscopic(Populations(), params_, Parity(), x, y, density, ux, uy);
+}
+
+void CpuSolver::Force(float* fx, float* fy) const
+{
+    *fx = 0.0f;
+    *fy = 0.0f;
+    std::mutex mutex;
+    ForRows([&](int y_begin, int y_end) {
+        float band_fx = 0.0f, band_fy = 0.0f;
+        ObstacleForce(Populations(), params_, solid_cells_.data(), y_begin, y_end, &band_fx,
+                      &band_fy);
+        std::lock_guard<std::mutex> lock(mutex);
+        *fx += band_fx;
+        *fy += band_fy;
+    });
+}
+
+double CpuSolver::Residual()
+{
+    const bool first = previous_u_.size() == 0;
+    if (first)
+        previous_u_ = AlignedBuffer<float>((size_t)2 * params_.width * params_.height);
+    double du2 = 0.0, u2 = 0.0;
+    std::mutex mutex;
+    ForRows([&](int y_begin, int y_end) {
+        double band_du2 = 0.0, band_u2 = 0.0;
+        for (int y = std::max(y_begin, 1); y < std::min(y_end, params_.height - 1); y++)
+        {
+            for (int x = 1; x < params_.width - 1; x++)
+            {
+                const size_t cell = (size_t)y * params_.width + x;
+                if (IsSolid(solid_cells_.data(), (int)cell))
+                    continue;
+                float density, ux, uy;
+                Macroscopic(x, y, &density, &ux, &uy);
+                float* previous = &previous_u_[2 * cell];
+                const float dx = ux - previous[0], dy = uy - previous[1];
+                band_du2 += dx * dx + dy * dy;
+                band_u2 += ux * ux + uy * uy;
+                previous[0] = ux;
+                previous[1] = uy;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        du2 += band_du2;
+        u2 += band_u2;
+    });
+    const uint64_t steps = first ? 0 : step_count_ - residual_step_;
+    residual_step_ = step_count_;
+    return VelocityResidual(du2, u2, steps);
+}
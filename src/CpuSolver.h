@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "AlignedBuffer.h"
+#include "CpuKernels.h"
+#include "Lattice.h"
+#include "ThreadPool.h"
+
+// Headless D2Q9 engine, a line-by-line port of kComputeShader. Same pull streaming, equilibrium
+// edges, bounce-back and collision operators (see Collision), double buffered like ssbo[0] /
+// ssbo[1] or in place with SimParams::in_place. With a thread pool, rows are split into bands;
+// each thread initializes the bands it later steps. The scalar kernel is StepRowsScalar<D2Q9>,
+// the one CpuLatticeSolver runs for the 3D lattices.
+class CpuSolver
+{
+  public:
+    // solid_cells is the same bitset that is uploaded to the GPU, one bit per cell. pool may be
+    // null to step on the calling thread, otherwise it must outlive the solver.
+    CpuSolver(const SimParams& params, const std::vector<uint32_t>& solid_cells,
+              ThreadPool* pool = nullptr);
+
+    void Step();
+    // count steps, through the wavefront when SetWavefront enabled it
+    void Step(int count);
+
+    // Replaces the state with f (PopLayout().Bytes()) taken after step_count steps, e.g. from a
+    // MappedCheckpoint. Each thread copies the bands it steps.
+    void Restore(const void* f, uint64_t step_count);
+
+    // Caps the kernel at level (the widest one the CPU supports is used by default). SIMD
+    // kernels need the SoA layout, AoS always runs the scalar kernel.
+    void SetSimdLevel(SimdLevel level);
+    SimdLevel GetSimdLevel() const
+    {
+        return simd_level_;
+    }
+
+    // Temporal blocking for Step(count): the threads form a pipeline in which each one advances
+    // levels_per_thread steps at once, row by row along a wavefront, with every level one row
+    // behind the one before and each thread a row behind the last level of the previous one.
+    // A row is then stepped again while it and its neighbors are still in cache, instead of
+    // each step streaming the whole grid through memory. 0 (the default) steps one at a time;
+    // in place streaming writes into the neighbor rows and always does.
+    void SetWavefront(int levels_per_thread)
+    {
+        wavefront_levels_ = levels_per_thread;
+    }
+    int Wavefront() const
+    {
+        return wavefront_levels_;
+    }
+
+    // Populations after the last step, indexed through PopLayout() like the SSBOs and stored as
+    // floats or halves (see LoadPopulation). In place and after an odd number of steps they are
+    // reversed, see SimParams::in_place.
+    const void* Populations() const
+    {
+        return f_[current_].data();
+    }
+    void* Populations()
+    {
+        return f_[current_].data();
+    }
+
+    // Density and velocity of cell (x, y); in place, only valid away from the domain edges
+    void Macroscopic(int x, int y, float* density, float* ux, float* uy) const;
+
+    // Force on the obstacle after the last step, see ObstacleForce
+    void Force(float* fx, float* fy) const;
+
+    // VelocityResidual since the previous call, over the interior fluid cells; keeps a copy of
+    // the velocity field for the next one
+    double Residual();
+
+    const PopulationLayout& PopLayout() const
+    {
+        return layout_;
+    }
+    const SimParams& Params() const
+    {
+        return params_;
+    }
+    const std::vector<uint32_t>& SolidCells() const
+    {
+        return solid_cells_;
+    }
+    uint64_t StepCount() const
+    {
+        return step_count_;
+    }
+    // Parity of the next step; in place, populations are stored reversed when it is odd
+    int Parity() const
+    {
+        return params_.in_place ? (int)(step_count_ & 1) : 0;
+    }
+
+  private:
+    StepArgs MakeStepArgs(const void* f_in, void* f_out) const;
+    // levels double buffered steps as one pipeline of num_stages threads
+    void StepWavefront(int levels, int num_stages);
+
+    // Runs fn(y_begin, y_end) over all rows, on the pool if there is one
+    template <class Fn> void ForRows(Fn&& fn) const
+    {
+        if (pool_ != nullptr)
+            pool_->ParallelFor(params_.height, fn);
+        else
+            fn(0, params_.height);
+    }
+
+    SimParams params_;
+    PopulationLayout layout_;
+    std::vector<uint32_t> solid_cells_;
+    ThreadPool* pool_;
+    AlignedBuffer<uint8_t> f_[2];
+    int current_ = 0;
+    uint64_t step_count_ = 0;
+    SimdLevel simd_level_;
+    StepRowsFn kernel_;
+
+    // Equilibrium at (rho = 1, u = (U0, 0)), streamed in from the domain edges
+    float edge_feq_[kNumVelocities];
+
+    // Positions of a wavefront stage done so far, on its own cache line
+    struct alignas(64) StageProgress
+    {
+        std::atomic<int> positions;
+    };
+    int wavefront_levels_ = 0;
+    std::unique_ptr<StageProgress[]> stage_progress_;
+
+    // Velocity field at the last Residual call, (ux, uy) per cell, allocated by the first one
+    AlignedBuffer<float> previous_u_;
+    uint64_t residual_step_ = 0;
+};
@@ -0,0 +1,123 @@
+#include "Geometry.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+
+// Non-horizontal polygon edge, crossing the rows [first_row, end_row)
+struct Edge
+{
+    int first_row;
+    int end_row;
+    HMM_Vec2 top;
+    float dxdy;
+    int winding; // 1 for edges going down in y, -1 going up
+};
+
+// Crossing of the current row by an edge
+struct Crossing
+{
+    float x;
+    int winding;
+};
+
+// Sets the bits [begin, end). Only the partial words at the ends of a row can be shared with the
+// neighboring rows' threads, those are merged atomically.
+static void SetBits(uint32_t* words, size_t begin, size_t end)
+{
+    while (begin < end)
+    {
+        size_t word = begin / 32;
+        size_t word_end = std::min(end, (word + 1) * 32);
+        uint32_t mask = (uint32_t)(((1ull << (word_end - begin)) - 1) << (begin % 32));
+        if (mask == ~0u)
+            words[word] = ~0u;
+        else
+            std::atomic_ref<uint32_t>(words[word]).fetch_or(mask, std::memory_order_relaxed);
+        begin = word_end;
+    }
+}
+
+std::vector<uint32_t> PolygonMask(int width, int height, const std::vector<Contour>& contours,
+                                  ThreadPool& pool, FillRule rule)
+{
+    // Rows y with y0 <= y < y1 cross the edge, so a vertex shared by two edges counts once
+    std::vector<Edge> edges;
+    for (const Contour& contour : contours)
+    {
+        for (size_t i = 0; i < contour.size(); i++)
+        {
+            HMM_Vec2 a = contour[i];
+            HMM_Vec2 b = contour[(i + 1) % contour.size()];
+            int winding = 1;
+            if (a.Y > b.Y)
+            {
+                std::swap(a, b);
+                winding = -1;
+            }
+            int first_row = (int)std::max(ceilf(a.Y), 0.0f);
+            int end_row = (int)std::min(ceilf(b.Y), (float)height);
+            if (first_row >= end_row)
+                continue;
+            float dxdy = (b.X - a.X) / (b.Y - a.Y);
+            edges.push_back({first_row, end_row, a, dxdy, winding});
+        }
+    }
+    std::sort(edges.begin(), edges.end(),
+              [](const Edge& a, const Edge& b) { return a.first_row < b.first_row; });
+
+    std::vector<uint32_t> solid_cells((width * height + 31) / 32, 0);
+    pool.ParallelFor(height, [&](int y_begin, int y_end) {
+        // Active edge table for the band, edges enter in first_row order and leave past end_row
+        std::vector<const Edge*> active;
+        std::vector<Crossing> crossings;
+        size_t next = 0;
+        for (; next < edges.size() && edges[next].first_row <= y_begin; next++)
+        {
+            if (edges[next].end_row > y_begin)
+                active.push_back(&edges[next]);
+        }
+
+        for (int y = y_begin; y < y_end; y++)
+        {
+            for (; next < edges.size() && edges[next].first_row <= y; next++)
+                active.push_back(&edges[next]);
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [y](const Edge* edge) { return edge->end_row <= y; }),
+                         active.end());
+
+            crossings.clear();
+            for (const Edge* edge : active)
+                crossings.push_back({edge->top.X + (y - edge->top.Y) * edge->dxdy, edge->winding});
+            std::sort(crossings.begin(), crossings.end(),
+                      [](const Crossing& a, const Crossing& b) { return a.x < b.x; });
+
+            // Spans between crossings where the rule says inside, boundary cells included
+            int winding = 0;
+            for (size_t i = 0; i + 1 < crossings.size(); i++)
+            {
+                winding += rule == FillRule::EvenOdd ? 1 : crossings[i].winding;
+                bool inside = rule == FillRule::EvenOdd ? (winding & 1) != 0 : winding != 0;
+                if (!inside)
+                    continue;
+                int x_begin = (int)std::max(ceilf(crossings[i].x), 0.0f);
+                int x_end = (int)std::min(floorf(crossings[i + 1].x) + 1.0f, (float)width);
+                if (x_begin < x_end)
+                    SetBits(solid_cells.data(), (size_t)y * width + x_begin,
+                            (size_t)y * width + x_end);
+            }
+        }
+    });
+    return solid_cells;
+}
+
+std::vector<uint32_t> WedgeMask(int width, int height, ThreadPool& pool)
+{
+    float sx = width / 2048.0f;
+    float sy = height / 512.0f;
+    HMM_Vec2 v1 = {(380 - 85) * sx, 256 * sy};
+    HMM_Vec2 v2 = {(380 + 85) * sx, (256 - 40) * sy};
+    HMM_Vec2 v3 = {(380 + 85) * sx, (256 + 40) * sy};
+    return PolygonMask(width, height, {{v1, v2, v3}}, pool);
+}
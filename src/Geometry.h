@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <HandmadeMath.h>
+
+#include "ThreadPool.h"
+
+// Closed outline in cell coordinates, the last vertex joining back to the first
+using Contour = std::vector<HMM_Vec2>;
+
+// Which regions of overlapping or nested contours are inside: NonZero fills wherever the outlines
+// wind around the point (the SVG default), EvenOdd turns every nested contour into a hole
+enum class FillRule
+{
+    NonZero,
+    EvenOdd
+};
+
+// Solid bitset of a width x height grid, one bit per cell as uploaded to the GPU, with the cells
+// inside the polygon set. Cell (x, y) is sampled at the point (x, y); contours may be concave and
+// cross each other.
+std::vector<uint32_t> PolygonMask(int width, int height, const std::vector<Contour>& contours,
+                                  ThreadPool& pool, FillRule rule = FillRule::NonZero);
+
+// The window's wedge, scaled from its 2048x512 grid to width x height
+std::vector<uint32_t> WedgeMask(int width, int height, ThreadPool& pool);
@@ -0,0 +1,534 @@
+#include "GeometryImport.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+
+// Bumped whenever rasterization changes, so that stale cached masks are not picked up
+const uint32_t kMaskCacheVersion = 1;
+
+struct MaskCacheHeader
+{
+    char magic[8]; // "CFDMASK"
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint32_t reserved;
+    uint64_t hash; // Of the geometry file, see LoadGeometryMask
+};
+
+const float kPi = 3.14159265f;
+
+// SVG user space to grid cell coordinates, y flipped, cell (x, y) sampled at its center
+struct SvgMapping
+{
+    float min_x;
+    float min_y;
+    float scale_x;
+    float scale_y;
+    int height;
+
+    HMM_Vec2 ToGrid(HMM_Vec2 v) const
+    {
+        return {(v.X - min_x) * scale_x - 0.5f, height - (v.Y - min_y) * scale_y - 0.5f};
+    }
+    // Segments of about a cell for a curve whose control polygon is this long in user space
+    int Segments(float length) const
+    {
+        float cells = length * std::max(fabsf(scale_x), fabsf(scale_y));
+        return std::clamp((int)ceilf(cells), 1, 1024);
+    }
+};
+
+// Value of attribute name in the element tag (from '<' to '>'), false when absent
+static bool Attribute(const std::string& tag, const char* name, std::string* value)
+{
+    const size_t name_length = strlen(name);
+    for (size_t pos = tag.find(name); pos != std::string::npos; pos = tag.find(name, pos + 1))
+    {
+        if (pos == 0 || !isspace((unsigned char)tag[pos - 1]))
+            continue;
+        size_t i = pos + name_length;
+        while (i < tag.size() && isspace((unsigned char)tag[i]))
+            i++;
+        if (i >= tag.size() || tag[i] != '=')
+            continue;
+        i++;
+        while (i < tag.size() && isspace((unsigned char)tag[i]))
+            i++;
+        if (i >= tag.size() || (tag[i] != '"' && tag[i] != '\''))
+            continue;
+        size_t end = tag.find(tag[i], i + 1);
+        if (end == std::string::npos)
+            return false;
+        *value = tag.substr(i + 1, end - i - 1);
+        return true;
+    }
+    return false;
+}
+
+// Numbers and flags of path data and point lists, separated by whitespace, commas or nothing
+struct SvgScanner
+{
+    const char* p;
+
+    void SkipSeparators()
+    {
+        while (*p != '\0' && (isspace((unsigned char)*p) || *p == ','))
+            p++;
+    }
+    bool AtNumber()
+    {
+        SkipSeparators();
+        return isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.';
+    }
+    bool Number(float* value)
+    {
+        SkipSeparators();
+        char* end = nullptr;
+        *value = strtof(p, &end);
+        if (end == p)
+            return false;
+        p = end;
+        return true;
+    }
+    bool Point(HMM_Vec2* v)
+    {
+        return Number(&v->X) && Number(&v->Y);
+    }
+    // Arc flags are single digits, possibly run together ("a5 5 0 115 5")
+    bool Flag(bool* value)
+    {
+        SkipSeparators();
+        if (*p != '0' && *p != '1')
+            return false;
+        *value = *p++ == '1';
+        return true;
+    }
+};
+
+static HMM_Vec2 Cubic(HMM_Vec2 p0, HMM_Vec2 p1, HMM_Vec2 p2, HMM_Vec2 p3, float t)
+{
+    float s = 1.0f - t;
+    return p0 * (s * s * s) + p1 * (3.0f * s * s * t) + p2 * (3.0f * s * t * t) + p3 * (t * t * t);
+}
+
+// Elliptical arc from p0 to p1, converted to center parameterization (SVG 1.1, F.6.5)
+static void AddArc(HMM_Vec2 p0, HMM_Vec2 radii, float rotation, bool large_arc, bool sweep,
+                   HMM_Vec2 p1, const SvgMapping& mapping, Contour* contour)
+{
+    float rx = fabsf(radii.X);
+    float ry = fabsf(radii.Y);
+    if (rx == 0.0f || ry == 0.0f)
+    {
+        contour->push_back(mapping.ToGrid(p1));
+        return;
+    }
+    const float phi = rotation * kPi / 180.0f;
+    const float cos_phi = cosf(phi), sin_phi = sinf(phi);
+    const HMM_Vec2 half = (p0 - p1) * 0.5f;
+    const float x1 = cos_phi * half.X + sin_phi * half.Y;
+    const float y1 = -sin_phi * half.X + cos_phi * half.Y;
+    // Radii too small to reach p1 are scaled up
+    const float lambda = x1 * x1 / (rx * rx) + y1 * y1 / (ry * ry);
+    if (lambda > 1.0f)
+    {
+        rx *= sqrtf(lambda);
+        ry *= sqrtf(lambda);
+    }
+    const float num = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+    const float den = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+    float coef = den > 0.0f ? sqrtf(std::max(num / den, 0.0f)) : 0.0f;
+    if (large_arc == sweep)
+        coef = -coef;
+    const float cx1 = coef * rx * y1 / ry;
+    const float cy1 = -coef * ry * x1 / rx;
+    const HMM_Vec2 center = {cos_phi * cx1 - sin_phi * cy1 + (p0.X + p1.X) * 0.5f,
+                             sin_phi * cx1 + cos_phi * cy1 + (p0.Y + p1.Y) * 0.5f};
+
+    const float theta = atan2f((y1 - cy1) / ry, (x1 - cx1) / rx);
+    float delta = atan2f((-y1 - cy1) / ry, (-x1 - cx1) / rx) - theta;
+    if (sweep && delta < 0.0f)
+        delta += 2.0f * kPi;
+    else if (!sweep && delta > 0.0f)
+        delta -= 2.0f * kPi;
+
+    const int segments = mapping.Segments(fabsf(delta) * std::max(rx, ry));
+    for (int k = 1; k <= segments; k++)
+    {
+        const float angle = theta + delta * k / segments;
+        const float ex = rx * cosf(angle), ey = ry * sinf(angle);
+        HMM_Vec2 v = {center.X + cos_phi * ex - sin_phi * ey,
+                      center.Y + sin_phi * ex + cos_phi * ey};
+        contour->push_back(mapping.ToGrid(k == segments ? p1 : v));
+    }
+}
+
+// Path data (the d attribute), one contour per subpath; open subpaths are closed for filling
+static void ParsePathData(const char* d, const SvgMapping& mapping, std::vector<Contour>* contours)
+{
+    SvgScanner scanner = {d};
+    Contour contour;
+    HMM_Vec2 current = {0.0f, 0.0f};
+    HMM_Vec2 start = current;
+    HMM_Vec2 control = current; // Last control point, reflected by S and T
+    char command = 0;
+    char previous = 0;
+    auto close_contour = [&]() {
+        if (contour.size() >= 3)
+            contours->push_back(contour);
+        contour.clear();
+    };
+
+    for (;;)
+    {
+        scanner.SkipSeparators();
+        if (*scanner.p == '\0')
+            break;
+        if (isalpha((unsigned char)*scanner.p))
+            command = *scanner.p++;
+        else if (command == 0 || command == 'Z' || command == 'z')
+            break; // Numbers without a command
+        const bool relative = islower((unsigned char)command) != 0;
+        const HMM_Vec2 origin = relative ? current : HMM_Vec2{0.0f, 0.0f};
+        const char kind = (char)toupper((unsigned char)command);
+
+        // Parameters are made absolute only once all of them have parsed, the path ends at the
+        // first one that does not
+        HMM_Vec2 c1, c2, end;
+        float value;
+        if (kind == 'M')
+        {
+            if (!scanner.Point(&end))
+                break;
+            close_contour();
+            current = start = control = origin + end;
+            contour.push_back(mapping.ToGrid(current));
+            // Further coordinate pairs are implicit line-tos
+            command = relative ? 'l' : 'L';
+        }
+        else if (kind == 'L')
+        {
+            if (!scanner.Point(&end))
+                break;
+            current = origin + end;
+            contour.push_back(mapping.ToGrid(current));
+        }
+        else if (kind == 'H' || kind == 'V')
+        {
+            if (!scanner.Number(&value))
+                break;
+            if (kind == 'H')
+                current.X = relative ? current.X + value : value;
+            else
+                current.Y = relative ? current.Y + value : value;
+            contour.push_back(mapping.ToGrid(current));
+        }
+        else if (kind == 'C' || kind == 'S' || kind == 'Q' || kind == 'T')
+        {
+            // Quadratics go through the same cubic evaluation with elevated control points
+            const bool smooth = kind == 'S' || kind == 'T';
+            const bool cubic = kind == 'C' || kind == 'S';
+            const bool chained = cubic ? previous == 'C' || previous == 'S'
+                                       : previous == 'Q' || previous == 'T';
+            const bool parsed = (smooth || scanner.Point(&c1)) && (!cubic || scanner.Point(&c2)) &&
+                                scanner.Point(&end);
+            if (!parsed)
+                break;
+            c1 = smooth ? (chained ? current * 2.0f - control : current) : origin + c1;
+            if (cubic)
+                c2 = origin + c2;
+            end = origin + end;
+            const HMM_Vec2 q = cubic ? current : c1;
+            if (!cubic)
+            {
+                c1 = current + (q - current) * (2.0f / 3.0f);
+                c2 = end + (q - end) * (2.0f / 3.0f);
+            }
+            const float length = HMM_LenV2(c1 - current) + HMM_LenV2(c2 - c1) + HMM_LenV2(end - c2);
+            const int segments = mapping.Segments(length);
+            for (int k = 1; k <= segments; k++)
+                contour.push_back(mapping.ToGrid(Cubic(current, c1, c2, end, (float)k / segments)));
+            control = cubic ? c2 : q;
+            current = end;
+        }
+        else if (kind == 'A')
+        {
+            HMM_Vec2 radii;
+            float rotation;
+            bool large_arc, sweep;
+            if (!scanner.Point(&radii) || !scanner.Number(&rotation) ||
+                !scanner.Flag(&large_arc) || !scanner.Flag(&sweep) || !scanner.Point(&end))
+                break;
+            end = origin + end;
+            AddArc(current, radii, rotation, large_arc, sweep, end, mapping, &contour);
+            current = end;
+        }
+        else if (kind == 'Z')
+        {
+            close_contour();
+            current = start;
+            // A subpath continuing without a move-to starts back at the closed one's start
+            contour.push_back(mapping.ToGrid(current));
+        }
+        else
+        {
+            break;
+        }
+
+        if (kind != 'C' && kind != 'S' && kind != 'Q' && kind != 'T')
+            control = current;
+        previous = kind;
+    }
+    close_contour();
+}
+
+bool ParseSvg(const char* text, int width, int height, std::vector<SvgShape>* shapes)
+{
+    const std::string document = text;
+    auto tag_at = [&](size_t pos) {
+        size_t end = document.find('>', pos);
+        return document.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    };
+
+    // The viewBox, or else the document size, maps onto the grid
+    const size_t svg = document.find("<svg");
+    if (svg == std::string::npos)
+    {
+        printf("No <svg> element\n");
+        return false;
+    }
+    const std::string root = tag_at(svg);
+    std::string value, box_height;
+    float box[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    if (Attribute(root, "viewBox", &value))
+    {
+        SvgScanner scanner = {value.c_str()};
+        for (float& v : box)
+            scanner.Number(&v);
+    }
+    else if (Attribute(root, "width", &value) && Attribute(root, "height", &box_height))
+    {
+        // Units are ignored, only the aspect matters
+        box[2] = strtof(value.c_str(), nullptr);
+        box[3] = strtof(box_height.c_str(), nullptr);
+    }
+    if (box[2] <= 0.0f || box[3] <= 0.0f)
+    {
+        printf("The <svg> element needs a viewBox or a width and height\n");
+        return false;
+    }
+    const SvgMapping mapping = {box[0], box[1], width / box[2], height / box[3], height};
+
+    shapes->clear();
+    for (size_t pos = document.find('<'); pos != std::string::npos;
+         pos = document.find('<', pos + 1))
+    {
+        if (document.compare(pos, 4, "<!--") == 0)
+        {
+            pos = document.find("-->", pos);
+            if (pos == std::string::npos)
+                break;
+            continue;
+        }
+        const std::string tag = tag_at(pos);
+        auto is_element = [&](const char* name) {
+            size_t length = strlen(name);
+            return tag.compare(1, length, name) == 0 && tag.size() > length + 1 &&
+                   (isspace((unsigned char)tag[length + 1]) || tag[length + 1] == '/');
+        };
+
+        SvgShape shape = {{}, FillRule::NonZero};
+        if (is_element("path") && Attribute(tag, "d", &value))
+        {
+            ParsePathData(value.c_str(), mapping, &shape.contours);
+        }
+        else if ((is_element("polygon") || is_element("polyline")) &&
+                 Attribute(tag, "points", &value))
+        {
+            SvgScanner scanner = {value.c_str()};
+            Contour contour;
+            HMM_Vec2 v;
+            while (scanner.AtNumber() && scanner.Point(&v))
+                contour.push_back(mapping.ToGrid(v));
+            if (contour.size() >= 3)
+                shape.contours.push_back(contour);
+        }
+        if (shape.contours.empty())
+            continue;
+
+        // Either as an attribute or in the style
+        std::string style;
+        if ((Attribute(tag, "fill-rule", &value) && value.find("evenodd") != std::string::npos) ||
+            (Attribute(tag, "style", &style) &&
+             style.find("fill-rule:evenodd") != std::string::npos))
+            shape.rule = FillRule::EvenOdd;
+        shapes->push_back(std::move(shape));
+    }
+    if (shapes->empty())
+    {
+        printf("No filled <path>, <polygon> or <polyline> elements\n");
+        return false;
+    }
+    return true;
+}
+
+std::vector<uint32_t> ImageMask(const GrayImage& image, int width, int height, ThreadPool& pool)
+{
+    // One 32-cell word of the bitset per iteration, so that no two threads share a word
+    std::vector<uint32_t> solid_cells((width * height + 31) / 32, 0);
+    pool.ParallelFor((int)solid_cells.size(), [&](int word_begin, int word_end) {
+        for (int word = word_begin; word < word_end; word++)
+        {
+            uint32_t bits = 0;
+            for (int bit = 0; bit < 32 && word * 32 + bit < width * height; bit++)
+            {
+                int x = (word * 32 + bit) % width;
+                int y = (word * 32 + bit) / width;
+                int px = (int)((x + 0.5) * image.width / width);
+                int py = (int)((height - y - 0.5) * image.height / height);
+                if (image.pixels[(size_t)py * image.width + px] < 128)
+                    bits |= 1u << bit;
+            }
+            solid_cells[word] = bits;
+        }
+    });
+    return solid_cells;
+}
+
+static bool ReadFile(const char* path, std::vector<uint8_t>* data)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr)
+        return false;
+    data->clear();
+    uint8_t buffer[65536];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data->insert(data->end(), buffer, buffer + read);
+    bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+// 64-bit FNV-1a
+static uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+static bool ReadCachedMask(const std::string& path, uint64_t hash, int width, int height,
+                           std::vector<uint32_t>* solid_cells)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    MaskCacheHeader header = {};
+    std::vector<uint32_t> words(((size_t)width * height + 31) / 32);
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, "CFDMASK", 8) == 0 && header.version == kMaskCacheVersion &&
+              header.width == width && header.height == height && header.hash == hash &&
+              fread(words.data(), sizeof(uint32_t), words.size(), file) == words.size();
+    fclose(file);
+    if (ok)
+        *solid_cells = std::move(words);
+    return ok;
+}
+
+static void WriteCachedMask(const char* cache_dir, const std::string& path, uint64_t hash,
+                            int width, int height, const std::vector<uint32_t>& solid_cells)
+{
+    std::error_code error;
+    std::filesystem::create_directories(cache_dir, error);
+    MaskCacheHeader header = {"CFDMASK", kMaskCacheVersion, width, height, 0, hash};
+    // Renamed into place, so that a concurrent run never reads a partial mask
+    std::string temp_path = path + ".tmp";
+    FILE* file = fopen(temp_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        printf("Cannot write mask cache %s\n", temp_path.c_str());
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(solid_cells.data(), sizeof(uint32_t), solid_cells.size(), file) ==
+                  solid_cells.size();
+    ok = fclose(file) == 0 && ok;
+    if (ok)
+        std::filesystem::rename(temp_path, path, error);
+    if (!ok || error)
+    {
+        printf("Cannot write mask cache %s\n", path.c_str());
+        remove(temp_path.c_str());
+    }
+}
+
+bool LoadGeometryMask(const char* path, int width, int height, ThreadPool& pool,
+                      const char* cache_dir, std::vector<uint32_t>* solid_cells)
+{
+    std::vector<uint8_t> data;
+    if (!ReadFile(path, &data))
+    {
+        printf("Cannot read geometry %s\n", path);
+        return false;
+    }
+    const uint64_t hash = HashBytes((const uint8_t*)&kMaskCacheVersion, sizeof(kMaskCacheVersion),
+                                    HashBytes(data.data(), data.size()));
+    std::string cache_path;
+    if (cache_dir != nullptr)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%016llx_%dx%d.mask", (unsigned long long)hash, width, height);
+        cache_path = std::string(cache_dir) + "/" + name;
+        if (ReadCachedMask(cache_path, hash, width, height, solid_cells))
+            return true;
+    }
+
+    // Told apart by their contents, whatever the file is named
+    GrayImage image;
+    bool ok;
+    if (data.size() >= 4 && memcmp(data.data(), "\x89PNG", 4) == 0)
+    {
+        ok = DecodePng(data.data(), data.size(), &image);
+    }
+    else if (data.size() >= 2 && data[0] == 'P' && (data[1] == '5' || data[1] == '2'))
+    {
+        ok = DecodePgm(data.data(), data.size(), &image);
+    }
+    else
+    {
+        std::vector<SvgShape> shapes;
+        data.push_back('\0');
+        ok = ParseSvg((const char*)data.data(), width, height, &shapes);
+        if (ok)
+        {
+            // Every element is filled on its own, the document is their union
+            solid_cells->assign(((size_t)width * height + 31) / 32, 0);
+            for (const SvgShape& shape : shapes)
+            {
+                std::vector<uint32_t> mask = PolygonMask(width, height, shape.contours, pool,
+                                                         shape.rule);
+                for (size_t i = 0; i < mask.size(); i++)
+                    (*solid_cells)[i] |= mask[i];
+            }
+        }
+    }
+    if (ok && !image.pixels.empty())
+        *solid_cells = ImageMask(image, width, height, pool);
+    if (!ok)
+    {
+        printf("Cannot load geometry %s\n", path);
+        return false;
+    }
+
+    if (!cache_path.empty())
+        WriteCachedMask(cache_dir, cache_path, hash, width, height, *solid_cells);
+    return true;
+}
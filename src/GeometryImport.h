@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Geometry.h"
+#include "Image.h"
+#include "ThreadPool.h"
+
+// Filled outline of one SVG element
+struct SvgShape
+{
+    std::vector<Contour> contours;
+    FillRule rule;
+};
+
+// The <path>, <polygon> and <polyline> elements of an SVG document, in the cell coordinates of a
+// width x height grid: the root viewBox (or width and height) spans the grid with y pointing up,
+// and PolygonMask then samples the cell centers. Curves and arcs are flattened into segments of
+// about a cell. Transforms, strokes and clip paths are ignored.
+bool ParseSvg(const char* text, int width, int height, std::vector<SvgShape>* shapes);
+
+// Cells whose center falls on a pixel darker than mid-gray are solid, the image stretched over the
+// grid with its first row at the top
+std::vector<uint32_t> ImageMask(const GrayImage& image, int width, int height, ThreadPool& pool);
+
+// Solid bitset of the geometry file at path, an SVG document or a PGM or PNG mask, on a width x
+// height grid. Rasterized masks are cached in cache_dir (nothing is cached when null) under a hash
+// of the file contents and the grid size.
+bool LoadGeometryMask(const char* path, int width, int height, ThreadPool& pool,
+                      const char* cache_dir, std::vector<uint32_t>* solid_cells);
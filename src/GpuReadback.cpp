@@ -0,0 +1,126 @@
+#include "GpuReadback.h"
+
+#include <algorithm>
+#include <utility>
+
+SnapshotReadback::SnapshotReadback(size_t bytes, int num_slots, Consumer consumer)
+    : bytes_(bytes), consumer_(std::move(consumer)), slots_(num_slots)
+{
+    // Coherent, so that a signaled fence is all the consumer needs before reading. Client
+    // storage asks for the copies to land in system memory the CPU reads at full speed.
+    const GLbitfield map_flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    for (Slot& slot : slots_)
+    {
+        glCreateBuffers(1, &slot.buffer);
+        glNamedBufferStorage(slot.buffer, bytes, nullptr, map_flags | GL_CLIENT_STORAGE_BIT);
+        slot.mapped = glMapNamedBufferRange(slot.buffer, 0, bytes, map_flags);
+    }
+    thread_ = std::thread([this]() { ConsumerLoop(); });
+}
+
+SnapshotReadback::~SnapshotReadback()
+{
+    Finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    queue_cv_.notify_one();
+    thread_.join();
+    for (Slot& slot : slots_)
+    {
+        glUnmapNamedBuffer(slot.buffer);
+        glDeleteBuffers(1, &slot.buffer);
+    }
+}
+
+bool SnapshotReadback::Capture(GLuint source, uint64_t step_count, int parity, int tag)
+{
+    int index = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int i = 0; i < (int)slots_.size() && index < 0; i++)
+        {
+            if (slots_[i].state == SlotState::Free)
+                index = i;
+        }
+        if (index < 0)
+        {
+            dropped_++;
+            return false;
+        }
+        slots_[index].state = SlotState::Copying;
+    }
+    Slot& slot = slots_[index];
+    slot.snapshot = {slot.mapped, bytes_, step_count, parity, tag};
+
+    // Shader writes to source only reach buffer copies after this barrier
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(source, slot.buffer, 0, 0, bytes_);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Submitted now rather than at the next swap, so that the copy starts right behind the steps
+    glFlush();
+    copying_.push_back(index);
+    return true;
+}
+
+void SnapshotReadback::Poll()
+{
+    bool queued = false;
+    while (!copying_.empty())
+    {
+        Slot& slot = slots_[copying_.front()];
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot.state = SlotState::Consuming;
+            queue_.push_back(copying_.front());
+        }
+        copying_.pop_front();
+        queued = true;
+    }
+    if (queued)
+        queue_cv_.notify_one();
+}
+
+void SnapshotReadback::Finish()
+{
+    for (int index : copying_)
+        glClientWaitSync(slots_[index].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    Poll();
+    std::unique_lock<std::mutex> lock(mutex_);
+    free_cv_.wait(lock, [this]() { return queue_.empty(); });
+}
+
+int SnapshotReadback::Pending()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (int)std::count_if(slots_.begin(), slots_.end(),
+                              [](const Slot& slot) { return slot.state != SlotState::Free; });
+}
+
+void SnapshotReadback::ConsumerLoop()
+{
+    for (;;)
+    {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queue_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            index = queue_.front();
+        }
+        consumer_(slots_[index].snapshot);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.pop_front();
+            slots_[index].state = SlotState::Free;
+        }
+        free_cv_.notify_all();
+    }
+}
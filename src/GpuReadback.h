@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glad/gl.h>
+
+// Copy of a buffer taken by SnapshotReadback::Capture, valid until the consumer returns
+struct Snapshot
+{
+    const void* data;
+    size_t bytes;
+    uint64_t step_count;
+    int parity;
+    int tag; // Passed through from Capture, e.g. to tell checkpoints from field dumps
+};
+
+// Readback ring of persistently mapped buffers. Capture copies a GPU buffer into a free slot and
+// fences the copy without waiting for it; Poll hands the slots whose fence has signaled to a
+// consumer thread, which gets the mapped memory directly and frees the slot when it returns. The
+// GL calls all happen on the thread owning the context, the consumer makes none.
+class SnapshotReadback
+{
+  public:
+    using Consumer = std::function<void(const Snapshot&)>;
+
+    SnapshotReadback(size_t bytes, int num_slots, Consumer consumer);
+    // Finishes the snapshots in flight
+    ~SnapshotReadback();
+
+    SnapshotReadback(const SnapshotReadback&) = delete;
+    SnapshotReadback& operator=(const SnapshotReadback&) = delete;
+
+    // Copies the first bytes of source after the commands issued so far. False, and nothing is
+    // copied, when every slot is still in flight or with the consumer.
+    bool Capture(GLuint source, uint64_t step_count, int parity, int tag = 0);
+    // Queues the finished copies for the consumer, once per frame
+    void Poll();
+    // Waits until every snapshot captured so far has been consumed
+    void Finish();
+
+    // Snapshots captured and not consumed yet
+    int Pending();
+    int Dropped() const
+    {
+        return dropped_;
+    }
+
+  private:
+    enum class SlotState
+    {
+        Free,
+        Copying,
+        Consuming
+    };
+
+    struct Slot
+    {
+        GLuint buffer = 0;
+        void* mapped = nullptr;
+        GLsync fence = nullptr;
+        SlotState state = SlotState::Free;
+        Snapshot snapshot = {};
+    };
+
+    void ConsumerLoop();
+
+    size_t bytes_;
+    Consumer consumer_;
+    std::vector<Slot> slots_;
+    std::deque<int> copying_; // Slots in capture order, the oldest fence first
+    int dropped_ = 0;
+
+    std::thread thread_;
+    std::mutex mutex_; // Guards the slot states, queue_ and stop_
+    std::condition_variable queue_cv_;
+    std::condition_variable free_cv_;
+    std::deque<int> queue_;
+    bool stop_ = false;
+};
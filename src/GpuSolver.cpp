@@ -0,0 +1,477 @@
+#include "GpuSolver.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "Shaders.h"
+
+std::string ShaderDefines(const SimParams& params)
+{
+    std::string defines;
+    if (params.layout == Layout::SoA)
+        defines += "#define LAYOUT_SOA\n";
+    if (params.in_place)
+        defines += "#define IN_PLACE\n";
+    if (params.precision == Precision::FP16)
+        defines += "#define FP16\n";
+    if (params.collision != Collision::BGK)
+    {
+        char rates[128];
+        snprintf(rates, sizeof(rates),
+                 "#define HEAT_FLUX_RATE %.9g\n"
+                 "#define MRT_RATE_E %.9g\n"
+                 "#define MRT_RATE_EPS %.9g\n",
+                 kHeatFluxRate, kMrtRateE, kMrtRateEps);
+        defines += params.collision == Collision::TRT ? "#define COLLISION_TRT\n"
+                                                      : "#define COLLISION_MRT\n";
+        defines += rates;
+    }
+    if (params.smagorinsky > 0.0f)
+    {
+        char smagorinsky[64];
+        snprintf(smagorinsky, sizeof(smagorinsky), "#define SMAGORINSKY %.9g\n",
+                 params.smagorinsky);
+        defines += smagorinsky;
+    }
+    return defines;
+}
+
+const char* GpuKernelName(GpuKernel kernel)
+{
+    return kernel == GpuKernel::Tiled ? "Tiled" : "Global";
+}
+
+// Largest population difference from the freestream equilibrium a quiescent cell may have. Above
+// the fp16 rounding of the populations around the weights.
+const float kQuiescentTolerance = 1e-5f;
+
+GpuSolver::GpuSolver(const SimParams& params, const std::vector<uint32_t>& solid_cells,
+                     const void* f_init, uint64_t step_count)
+    : params_(params), layout_(params), parity_(params.in_place ? (int)(step_count & 1) : 0),
+      step_count_(step_count)
+{
+    const size_t buffer_size = layout_.Bytes();
+
+    // Current and updated distribution functions, the same buffer in place
+    glCreateBuffers(params.in_place ? 1 : 2, ssbo_);
+    glNamedBufferStorage(ssbo_[0], buffer_size, f_init, GL_DYNAMIC_STORAGE_BIT);
+    if (params.in_place)
+        ssbo_[1] = ssbo_[0];
+    else
+        glNamedBufferStorage(ssbo_[1], buffer_size, f_init, GL_DYNAMIC_STORAGE_BIT);
+
+    glCreateBuffers(1, &solid_buffer_);
+    glNamedBufferStorage(solid_buffer_, solid_cells.size() * sizeof(uint32_t), solid_cells.data(),
+                         0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, solid_buffer_);
+
+    // Solid until the first update, which may skip fully solid tiles
+    glCreateTextures(GL_TEXTURE_2D, 1, &fields_texture_);
+    glTextureStorage2D(fields_texture_, 1, GL_RGBA16F, params.width, params.height);
+    const float solid_texel[4] = {1.0f, 0.0f, 0.0f, 1.0f};
+    glClearTexImage(fields_texture_, 0, GL_RGBA, GL_FLOAT, solid_texel);
+
+    for (int kernel = 0; kernel < 2; kernel++)
+    {
+        for (int sparse = 0; sparse < 2; sparse++)
+        {
+            std::string defines = ShaderDefines(params);
+            if ((GpuKernel)kernel == GpuKernel::Tiled)
+                defines += "#define TILED\n";
+            if (sparse)
+                defines += "#define SPARSE\n";
+            ComputeVariant& variant = variants_[kernel][sparse];
+            variant.shader = glCreateShader(GL_COMPUTE_SHADER);
+            ShaderSourceWithDefines(variant.shader, kComputeShader, defines.c_str());
+            CompileShader(variant.shader);
+            variant.program = CreateProgram({variant.shader});
+            variant.parity_location = variant.program.Uniform("parity");
+            variant.quiescent_pass_location = variant.program.Uniform("quiescent_pass");
+            variant.write_fields_location = variant.program.Uniform("write_fields");
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::string defines = ShaderDefines(params);
+        if (pass == 0)
+            defines += "#define CLASSIFY\n";
+        tile_shaders_[pass] = glCreateShader(GL_COMPUTE_SHADER);
+        ShaderSourceWithDefines(tile_shaders_[pass], kTileShader, defines.c_str());
+        CompileShader(tile_shaders_[pass]);
+    }
+    classify_program_ = CreateProgram({tile_shaders_[0]});
+    list_program_ = CreateProgram({tile_shaders_[1]});
+    tolerance_location_ = classify_program_.Uniform("tolerance");
+
+    num_tiles_ = (params.width / 16) * (params.height / 16);
+    glCreateBuffers(1, &tile_lists_);
+    glNamedBufferStorage(tile_lists_, (8 + 2 * num_tiles_) * sizeof(uint32_t), nullptr,
+                         GL_DYNAMIC_STORAGE_BIT);
+    glCreateBuffers(1, &tile_flags_);
+    glNamedBufferStorage(tile_flags_, num_tiles_ * sizeof(uint32_t), nullptr, 0);
+    glCreateBuffers(1, &tile_counts_);
+    glNamedBufferStorage(tile_counts_, 8 * sizeof(uint32_t), nullptr, 0);
+    ResetTiles();
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        std::string defines = ShaderDefines(params);
+        if (pass == 1)
+            defines += "#define REDUCE\n";
+        force_shaders_[pass] = glCreateShader(GL_COMPUTE_SHADER);
+        ShaderSourceWithDefines(force_shaders_[pass], kForceShader, defines.c_str());
+        CompileShader(force_shaders_[pass]);
+    }
+    force_program_ = CreateProgram({force_shaders_[0]});
+    force_reduce_program_ = CreateProgram({force_shaders_[1]});
+    box_origin_location_ = force_program_.Uniform("box_origin");
+    num_partials_location_ = force_reduce_program_.Uniform("num_partials");
+    sample_slot_location_ = force_reduce_program_.Uniform("sample_slot");
+
+    // Only the cells around the obstacle have links to it
+    int box_min[2] = {params.width, params.height}, box_max[2] = {-1, -1};
+    for (int y = 0; y < params.height; y++)
+    {
+        for (int x = 0; x < params.width; x++)
+        {
+            int bit_index = y * params.width + x;
+            if ((solid_cells[bit_index / 32] >> (bit_index % 32)) & 1)
+            {
+                box_min[0] = std::min(box_min[0], x);
+                box_min[1] = std::min(box_min[1], y);
+                box_max[0] = std::max(box_max[0], x);
+                box_max[1] = std::max(box_max[1], y);
+            }
+        }
+    }
+    for (int axis = 0; axis < 2 && box_max[0] >= 0; axis++)
+    {
+        force_box_[axis] = std::max(box_min[axis] - 1, 0);
+        force_groups_[axis] = (box_max[axis] + 1 - force_box_[axis]) / 16 + 1;
+    }
+    glCreateBuffers(1, &force_partials_);
+    glNamedBufferStorage(force_partials_,
+                         std::max(force_groups_[0] * force_groups_[1], 1) * 2 * sizeof(float),
+                         nullptr, 0);
+    const GLbitfield map_flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glCreateBuffers(1, &force_samples_);
+    glNamedBufferStorage(force_samples_, kForceRingSize * 2 * sizeof(float), nullptr, map_flags);
+    force_mapped_ = (const float*)glMapNamedBufferRange(force_samples_, 0,
+                                                        kForceRingSize * 2 * sizeof(float),
+                                                        map_flags);
+
+    std::string residual_defines = ShaderDefines(params) + "#define RESIDUAL\n";
+    residual_shader_ = glCreateShader(GL_COMPUTE_SHADER);
+    ShaderSourceWithDefines(residual_shader_, kForceShader, residual_defines.c_str());
+    CompileShader(residual_shader_);
+    residual_program_ = CreateProgram({residual_shader_});
+    residual_parity_location_ = residual_program_.Uniform("parity");
+    glCreateBuffers(1, &residual_partials_);
+    glNamedBufferStorage(residual_partials_,
+                         (params.width / 16) * (params.height / 16) * 2 * sizeof(float), nullptr,
+                         0);
+    glCreateBuffers(1, &previous_velocity_);
+    glNamedBufferStorage(previous_velocity_,
+                         (size_t)params.width * params.height * 2 * sizeof(float), nullptr, 0);
+    glCreateBuffers(1, &residual_samples_);
+    glNamedBufferStorage(residual_samples_, kResidualRingSize * 2 * sizeof(float), nullptr,
+                         map_flags);
+    residual_mapped_ = (const float*)glMapNamedBufferRange(
+        residual_samples_, 0, kResidualRingSize * 2 * sizeof(float), map_flags);
+
+    uniforms_.Create(0);
+    uniforms_.data = {params.width, params.height, params.U0, params.tau,
+                      (int32_t)layout_.plane_stride};
+    uniforms_.Update();
+}
+
+GpuSolver::~GpuSolver()
+{
+    for (auto& kernel_variants : variants_)
+    {
+        for (ComputeVariant& variant : kernel_variants)
+        {
+            glDeleteProgram(variant.program.id);
+            glDeleteShader(variant.shader);
+        }
+    }
+    for (ForceBatch& batch : force_batches_)
+        glDeleteSync(batch.fence);
+    glUnmapNamedBuffer(force_samples_);
+    glDeleteBuffers(1, &force_samples_);
+    glDeleteBuffers(1, &force_partials_);
+    glDeleteProgram(force_program_.id);
+    glDeleteProgram(force_reduce_program_.id);
+    glDeleteShader(force_shaders_[0]);
+    glDeleteShader(force_shaders_[1]);
+    for (ResidualBatch& batch : residual_batches_)
+        glDeleteSync(batch.fence);
+    glUnmapNamedBuffer(residual_samples_);
+    glDeleteBuffers(1, &residual_samples_);
+    glDeleteBuffers(1, &residual_partials_);
+    glDeleteBuffers(1, &previous_velocity_);
+    glDeleteProgram(residual_program_.id);
+    glDeleteShader(residual_shader_);
+    glDeleteProgram(classify_program_.id);
+    glDeleteProgram(list_program_.id);
+    glDeleteShader(tile_shaders_[0]);
+    glDeleteShader(tile_shaders_[1]);
+    if (counts_fence_ != nullptr)
+        glDeleteSync(counts_fence_);
+    glDeleteBuffers(1, &tile_flags_);
+    glDeleteBuffers(1, &tile_lists_);
+    glDeleteBuffers(1, &tile_counts_);
+    glDeleteBuffers(params_.in_place ? 1 : 2, ssbo_);
+    glDeleteBuffers(1, &solid_buffer_);
+    glDeleteTextures(1, &fields_texture_);
+    glDeleteBuffers(1, &uniforms_.id);
+}
+
+void GpuSolver::SetSparse(bool sparse)
+{
+    // Lists from an earlier sparse period no longer match the flow. In place at odd parity the
+    // next rebuild waits a step, which then has to run every tile.
+    if (sparse && !sparse_)
+        ResetTiles();
+    sparse_ = sparse;
+}
+
+TileCounts GpuSolver::GetTileCounts()
+{
+    if (counts_fence_ == nullptr)
+        return counts_;
+    GLenum status = glClientWaitSync(counts_fence_, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return counts_;
+    uint32_t dispatch[8];
+    glGetNamedBufferSubData(tile_counts_, 0, sizeof(dispatch), dispatch);
+    counts_.active = (int)dispatch[0];
+    counts_.quiescent = (int)dispatch[4];
+    counts_.skipped = num_tiles_ - counts_.active - counts_.quiescent;
+    glDeleteSync(counts_fence_);
+    counts_fence_ = nullptr;
+    return counts_;
+}
+
+void GpuSolver::SetForceSampling(bool enabled)
+{
+    force_sampling_ = enabled;
+}
+
+void GpuSolver::PollForces(std::vector<ForceSample>* samples)
+{
+    CollectForces(false);
+    samples->insert(samples->end(), completed_forces_.begin(), completed_forces_.end());
+    completed_forces_.clear();
+}
+
+void GpuSolver::CollectForces(bool wait)
+{
+    while (!force_batches_.empty())
+    {
+        const ForceBatch& batch = force_batches_.front();
+        GLenum status = wait ? glClientWaitSync(batch.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                                GL_TIMEOUT_IGNORED)
+                             : glClientWaitSync(batch.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        for (int k = 0; k < batch.count; k++)
+        {
+            int slot = (batch.first_slot + k) % kForceRingSize;
+            completed_forces_.push_back(
+                {batch.first_step + k, force_mapped_[2 * slot], force_mapped_[2 * slot + 1]});
+        }
+        force_in_flight_ -= batch.count;
+        glDeleteSync(batch.fence);
+        force_batches_.pop_front();
+        wait = false;
+    }
+}
+
+void GpuSolver::SampleForce(uint64_t step)
+{
+    if (force_in_flight_ == kForceRingSize)
+    {
+        // The ring is full of samples nobody polled yet: they are kept, the CPU just waits
+        EndForceBatch();
+        CollectForces(true);
+    }
+    if (open_batch_.count == 0)
+    {
+        open_batch_.first_step = step;
+        open_batch_.first_slot =
+            force_batches_.empty()
+                ? 0
+                : (force_batches_.back().first_slot + force_batches_.back().count) % kForceRingSize;
+    }
+    const int slot = (open_batch_.first_slot + open_batch_.count) % kForceRingSize;
+    open_batch_.count++;
+    force_in_flight_++;
+
+    // Populations of the current buffer, which the step just wrote
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo_[0]);
+    glUseProgram(force_program_.id);
+    glUniform2i(box_origin_location_, force_box_[0], force_box_[1]);
+    glDispatchCompute(force_groups_[0], force_groups_[1], 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glUseProgram(force_reduce_program_.id);
+    glUniform1i(num_partials_location_, force_groups_[0] * force_groups_[1]);
+    glUniform1i(sample_slot_location_, slot);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GpuSolver::SampleResidual()
+{
+    if ((int)residual_batches_.size() == kResidualRingSize)
+        CollectResiduals(true);
+
+    // Step rebinds the force buffers to these slots
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniforms_.id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo_[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, solid_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, residual_partials_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, residual_samples_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, previous_velocity_);
+    glUseProgram(residual_program_.id);
+    glUniform1i(residual_parity_location_, parity_);
+    glDispatchCompute(params_.width / 16, params_.height / 16, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    const int slot = next_residual_slot_;
+    next_residual_slot_ = (next_residual_slot_ + 1) % kResidualRingSize;
+    glUseProgram(force_reduce_program_.id);
+    glUniform1i(num_partials_location_, (params_.width / 16) * (params_.height / 16));
+    glUniform1i(sample_slot_location_, slot);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+
+    const uint64_t steps = has_residual_ ? step_count_ - residual_step_ : 0;
+    residual_batches_.push_back(
+        {glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), step_count_, steps, slot});
+    residual_step_ = step_count_;
+    has_residual_ = true;
+}
+
+void GpuSolver::PollResiduals(std::vector<ResidualSample>* samples)
+{
+    CollectResiduals(false);
+    samples->insert(samples->end(), completed_residuals_.begin(), completed_residuals_.end());
+    completed_residuals_.clear();
+}
+
+void GpuSolver::CollectResiduals(bool wait)
+{
+    while (!residual_batches_.empty())
+    {
+        const ResidualBatch& batch = residual_batches_.front();
+        GLenum status = wait ? glClientWaitSync(batch.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                                GL_TIMEOUT_IGNORED)
+                             : glClientWaitSync(batch.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        const float* sums = residual_mapped_ + 2 * batch.slot;
+        completed_residuals_.push_back(
+            {batch.step, VelocityResidual(sums[0], sums[1], batch.steps)});
+        glDeleteSync(batch.fence);
+        residual_batches_.pop_front();
+        wait = false;
+    }
+}
+
+void GpuSolver::EndForceBatch()
+{
+    if (open_batch_.count == 0)
+        return;
+    // Shader writes only reach a persistent mapping after this barrier
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    open_batch_.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    force_batches_.push_back(open_batch_);
+    open_batch_ = {};
+}
+
+void GpuSolver::ResetTiles()
+{
+    std::vector<uint32_t> lists(8 + num_tiles_, 0);
+    const uint32_t dispatch[8] = {(uint32_t)num_tiles_, 1, 1, 0, 0, 1, 1, 0};
+    std::copy(dispatch, dispatch + 8, lists.begin());
+    std::iota(lists.begin() + 8, lists.end(), 0u);
+    glNamedBufferSubData(tile_lists_, 0, lists.size() * sizeof(uint32_t), lists.data());
+    if (counts_fence_ != nullptr)
+        glDeleteSync(counts_fence_);
+    counts_fence_ = nullptr;
+    counts_ = {num_tiles_, 0, 0};
+    steps_since_rebuild_ = kTileRebuildInterval;
+}
+
+void GpuSolver::RebuildTiles()
+{
+    // Populations of the current buffer, which the last step wrote
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo_[0]);
+    glUseProgram(classify_program_.id);
+    glUniform1f(tolerance_location_, kQuiescentTolerance);
+    glDispatchCompute(params_.width / 16, params_.height / 16, 1);
+
+    const uint32_t reset[8] = {0, 1, 1, 0, 0, 1, 1, 0};
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    glNamedBufferSubData(tile_lists_, 0, sizeof(reset), reset);
+    glUseProgram(list_program_.id);
+    glDispatchCompute((num_tiles_ + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT |
+                    GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glCopyNamedBufferSubData(tile_lists_, tile_counts_, 0, 0, sizeof(reset));
+    if (counts_fence_ != nullptr)
+        glDeleteSync(counts_fence_);
+    counts_fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    steps_since_rebuild_ = 0;
+}
+
+void GpuSolver::Step(int count, bool update_fields)
+{
+    uniforms_.Update();
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, uniforms_.id);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, solid_buffer_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, tile_flags_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, tile_lists_);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, tile_lists_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, force_partials_);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, force_samples_);
+    glBindImageTexture(0, fields_texture_, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    const ComputeVariant& variant = variants_[(int)kernel_][sparse_ ? 1 : 0];
+    for (int step = 0; step < count; step++)
+    {
+        // In place, classification needs every cell's populations in its own slots
+        if (sparse_ && steps_since_rebuild_ >= kTileRebuildInterval && parity_ == 0)
+            RebuildTiles();
+        glUseProgram(variant.program.id);
+        glUniform1i(variant.parity_location, parity_);
+        const bool write_fields = update_fields && step == count - 1;
+        glUniform1i(variant.write_fields_location, write_fields ? 1 : 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo_[0]); // f_in
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo_[1]); // f_out
+        if (sparse_)
+        {
+            glUniform1i(variant.quiescent_pass_location, 0);
+            glDispatchComputeIndirect(0);
+            glUniform1i(variant.quiescent_pass_location, 1);
+            glDispatchComputeIndirect(4 * sizeof(uint32_t));
+        }
+        else
+        {
+            glDispatchCompute(params_.width / 16, params_.height / 16, 1);
+        }
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT |
+                        (write_fields ? GL_TEXTURE_FETCH_BARRIER_BIT : 0));
+        std::swap(ssbo_[0], ssbo_[1]);
+        parity_ ^= params_.in_place ? 1 : 0;
+        steps_since_rebuild_++;
+        if (force_sampling_ && force_groups_[0] > 0)
+            SampleForce(step_count_ + step + 1);
+    }
+    EndForceBatch();
+    step_count_ += count;
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "Lattice.h"
+#include "OpenGLHelpers.h"
+
+// std140 mirror of the SimParams uniform block in the shaders
+struct SimUniforms
+{
+    int32_t width;
+    int32_t height;
+    float U0;
+    float tau;
+    int32_t plane_stride;
+};
+
+// #define lines selecting the shader variants for params, for ShaderSourceWithDefines
+std::string ShaderDefines(const SimParams& params);
+
+// Variants of kComputeShader. Global pulls every population straight from the SSBO, Tiled first
+// gathers the work group's populations and solid bits into shared memory.
+enum class GpuKernel
+{
+    Global,
+    Tiled
+};
+
+const char* GpuKernelName(GpuKernel kernel);
+
+// Steps between tile classifications, in place rounded up to an even step count. Quiescent tiles
+// are 16 cells from anything else, so this has to stay below 16.
+const int kTileRebuildInterval = 8;
+
+// Tiles of the sparse schedule, see GpuSolver::SetSparse
+struct TileCounts
+{
+    int active;
+    int quiescent;
+    int skipped; // Solid, with no fluid cell next to them
+};
+
+// Force on the obstacle after a step, in lattice units, see GpuSolver::SetForceSampling
+struct ForceSample
+{
+    uint64_t step;
+    float fx; // Drag for the inflow along +x
+    float fy;
+};
+
+// Samples the GPU may hold before GpuSolver::Step waits for the oldest ones to be read
+const int kForceRingSize = 4096;
+
+// VelocityResidual since the previous sample, see GpuSolver::SampleResidual
+struct ResidualSample
+{
+    uint64_t step;
+    double residual;
+};
+
+// Residual samples the GPU may hold before SampleResidual waits for the oldest one to be read
+const int kResidualRingSize = 64;
+
+// The compute side of the window: population SSBOs, the solid bitset and the stream/collide
+// program. Needs a current GL 4.6 context. Binds the SimParams block at uniform binding 0 and the
+// solid bitset at storage binding 2 up front and again on every Step, for any program that reads
+// them.
+class GpuSolver
+{
+  public:
+    // f_init holds PopulationLayout::Bytes(), see InitPopulations, taken after step_count steps
+    // when resuming from a checkpoint
+    GpuSolver(const SimParams& params, const std::vector<uint32_t>& solid_cells,
+              const void* f_init, uint64_t step_count = 0);
+    ~GpuSolver();
+
+    GpuSolver(const GpuSolver&) = delete;
+    GpuSolver& operator=(const GpuSolver&) = delete;
+
+    // Dispatches count steps, with a storage barrier after each. With update_fields, the last one
+    // also writes FieldsTexture.
+    void Step(int count, bool update_fields = false);
+
+    // Both kernels are built up front, switching takes effect from the next step
+    void SetKernel(GpuKernel kernel)
+    {
+        kernel_ = kernel;
+    }
+    GpuKernel GetKernel() const
+    {
+        return kernel_;
+    }
+
+    // Sparse scheduling: every kTileRebuildInterval steps the 16x16 tiles are classified on the
+    // GPU, and steps then dispatch the active tiles indirectly, write the freestream equilibrium
+    // to quiescent ones without reading anything, and skip solid tiles nothing reads
+    void SetSparse(bool sparse);
+    bool Sparse() const
+    {
+        return sparse_;
+    }
+    // Counts from the most recent rebuild the GPU has finished, without waiting for one
+    TileCounts GetTileCounts();
+
+    // Momentum exchange over every fluid-solid link after each step from now on, reduced on the
+    // GPU into a persistently mapped ring, so that reading it never stalls the steps in flight
+    void SetForceSampling(bool enabled);
+    bool ForceSampling() const
+    {
+        return force_sampling_;
+    }
+    // Appends the samples of the batches the GPU has finished, in step order, without waiting
+    void PollForces(std::vector<ForceSample>* samples);
+
+    // Reduces the change of the velocity field since the previous call on the GPU, into a
+    // persistently mapped ring like the forces; cheap enough to call every few hundred steps
+    void SampleResidual();
+    // Appends the residuals the GPU has finished, in step order, without waiting
+    void PollResiduals(std::vector<ResidualSample>* samples);
+
+    // RGBA16F width x height texture of density, x and y velocity, and 1 in solid cells (texel y
+    // is the cell row), as of the last Step asked to update it
+    GLuint FieldsTexture() const
+    {
+        return fields_texture_;
+    }
+
+    // Buffer holding the populations after the last step
+    GLuint Populations() const
+    {
+        return ssbo_[0];
+    }
+    // Parity of the next step; in place, populations are stored reversed when it is odd
+    int Parity() const
+    {
+        return parity_;
+    }
+    uint64_t StepCount() const
+    {
+        return step_count_;
+    }
+    const SimParams& Params() const
+    {
+        return params_;
+    }
+    const PopulationLayout& PopLayout() const
+    {
+        return layout_;
+    }
+
+  private:
+    // One build of kComputeShader
+    struct ComputeVariant
+    {
+        GLuint shader = 0;
+        Program program;
+        GLint parity_location = -1;
+        GLint quiescent_pass_location = -1;
+        GLint write_fields_location = -1;
+    };
+
+    // Samples dispatched by one Step, readable once its fence is signaled
+    struct ForceBatch
+    {
+        GLsync fence;
+        uint64_t first_step;
+        int first_slot;
+        int count;
+    };
+
+    // One SampleResidual call, readable once its fence is signaled
+    struct ResidualBatch
+    {
+        GLsync fence;
+        uint64_t step;
+        uint64_t steps; // Since the previous sample, 0 for the first one
+        int slot;
+    };
+
+    // Every tile active until the next rebuild
+    void ResetTiles();
+    void RebuildTiles();
+    void SampleForce(uint64_t step);
+    void EndForceBatch();
+    // Reads the finished batches into completed_forces_, waiting for the oldest one if asked
+    void CollectForces(bool wait);
+    // Reads the finished residual samples into completed_residuals_, see CollectForces
+    void CollectResiduals(bool wait);
+
+    SimParams params_;
+    PopulationLayout layout_;
+    GLuint ssbo_[2] = {};
+    GLuint solid_buffer_ = 0;
+    GLuint fields_texture_ = 0;
+    ComputeVariant variants_[2][2]; // Indexed by GpuKernel, then sparse
+    GpuKernel kernel_ = GpuKernel::Global;
+    bool sparse_ = false;
+    GLuint tile_shaders_[2] = {};
+    Program classify_program_;
+    Program list_program_;
+    GLint tolerance_location_ = -1;
+    GLuint tile_flags_ = 0;
+    GLuint tile_lists_ = 0;  // Dispatch arguments, then the active and quiescent lists
+    GLuint tile_counts_ = 0; // Copy of the arguments for GetTileCounts
+    GLsync counts_fence_ = nullptr;
+    TileCounts counts_ = {};
+    int num_tiles_ = 0;
+    int steps_since_rebuild_ = 0;
+    GLuint force_shaders_[2] = {};
+    Program force_program_;
+    Program force_reduce_program_;
+    GLint box_origin_location_ = -1;
+    GLint num_partials_location_ = -1;
+    GLint sample_slot_location_ = -1;
+    int force_box_[2] = {};    // Lowest cell of the obstacle's bounding box, one cell out
+    int force_groups_[2] = {}; // Work groups covering the box
+    GLuint force_partials_ = 0;
+    GLuint force_samples_ = 0;
+    const float* force_mapped_ = nullptr; // Persistent coherent mapping of force_samples_
+    bool force_sampling_ = false;
+    std::deque<ForceBatch> force_batches_;
+    ForceBatch open_batch_ = {};
+    int force_in_flight_ = 0; // Samples in fenced batches and open_batch_
+    std::vector<ForceSample> completed_forces_;
+    GLuint residual_shader_ = 0;
+    Program residual_program_;
+    GLint residual_parity_location_ = -1;
+    GLuint residual_partials_ = 0;
+    GLuint residual_samples_ = 0;
+    GLuint previous_velocity_ = 0;
+    const float* residual_mapped_ = nullptr; // Persistent coherent mapping of residual_samples_
+    std::deque<ResidualBatch> residual_batches_;
+    uint64_t residual_step_ = 0;
+    bool has_residual_ = false;
+    int next_residual_slot_ = 0;
+    std::vector<ResidualSample> completed_residuals_;
+    UniformBuffer<SimUniforms> uniforms_;
+    int parity_ = 0;
+    uint64_t step_count_ = 0;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <bit>
+
+// IEEE 754 binary16 conversions for the scalar code paths. Rounds to nearest even, like F16C
+// and packHalf2x16 on current GPUs.
+inline uint16_t FloatToHalf(float value)
+{
+    const uint32_t kInfinity = 255u << 23;
+    const uint32_t kHalfOverflow = (127u + 16) << 23;
+    // Adding it to a value below the smallest normal half leaves the half's bits in the mantissa
+    const uint32_t kDenormalMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    const uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    uint16_t half;
+    if (bits >= kHalfOverflow)
+    {
+        half = bits > kInfinity ? 0x7E00 : 0x7C00;
+    }
+    else if (bits < (113u << 23))
+    {
+        float shifted = std::bit_cast<float>(bits) + std::bit_cast<float>(kDenormalMagic);
+        half = (uint16_t)(std::bit_cast<uint32_t>(shifted) - kDenormalMagic);
+    }
+    else
+    {
+        const uint32_t mantissa_odd = (bits >> 13) & 1;
+        bits += ((15u - 127) << 23) + 0xFFF + mantissa_odd;
+        half = (uint16_t)(bits >> 13);
+    }
+    return half | (uint16_t)(sign >> 16);
+}
+
+inline float HalfToFloat(uint16_t half)
+{
+    const uint32_t kExponentMask = 0x7C00u << 13;
+    uint32_t bits = (uint32_t)(half & 0x7FFF) << 13;
+    const uint32_t exponent = bits & kExponentMask;
+    bits += (127u - 15) << 23;
+    if (exponent == kExponentMask)
+    {
+        bits += (128u - 16) << 23; // Inf or NaN
+    }
+    else if (exponent == 0)
+    {
+        // Denormal, renormalized through a float subtraction
+        bits += 1u << 23;
+        float renormalized = std::bit_cast<float>(bits) - std::bit_cast<float>(113u << 23);
+        bits = std::bit_cast<uint32_t>(renormalized);
+    }
+    return std::bit_cast<float>(bits | (uint32_t)(half & 0x8000) << 16);
+}
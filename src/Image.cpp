@@ -0,0 +1,459 @@
+#include "Image.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Reads a PGM header or plain sample value, skipping whitespace and # comments
+static bool ReadPgmNumber(const uint8_t* data, size_t size, size_t* pos, int* value)
+{
+    while (*pos < size && (isspace(data[*pos]) || data[*pos] == '#'))
+    {
+        if (data[*pos] == '#')
+        {
+            while (*pos < size && data[*pos] != '\n')
+                (*pos)++;
+        }
+        else
+        {
+            (*pos)++;
+        }
+    }
+    if (*pos >= size || !isdigit(data[*pos]))
+        return false;
+    *value = 0;
+    while (*pos < size && isdigit(data[*pos]) && *value < 1 << 24)
+        *value = *value * 10 + (data[(*pos)++] - '0');
+    return true;
+}
+
+bool DecodePgm(const uint8_t* data, size_t size, GrayImage* image)
+{
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '2'))
+    {
+        printf("Not a PGM file\n");
+        return false;
+    }
+    const bool binary = data[1] == '5';
+    size_t pos = 2;
+    int width = 0, height = 0, max_value = 0;
+    if (!ReadPgmNumber(data, size, &pos, &width) || !ReadPgmNumber(data, size, &pos, &height) ||
+        !ReadPgmNumber(data, size, &pos, &max_value) || width <= 0 || height <= 0 ||
+        max_value <= 0 || max_value > 65535)
+    {
+        printf("Bad PGM header\n");
+        return false;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->pixels.resize((size_t)width * height);
+    const size_t num_pixels = image->pixels.size();
+    if (binary)
+    {
+        // A single whitespace character separates the header from the samples
+        pos++;
+        const size_t sample_bytes = max_value > 255 ? 2 : 1;
+        if (pos > size || size - pos < num_pixels * sample_bytes)
+        {
+            printf("Truncated PGM\n");
+            return false;
+        }
+        for (size_t i = 0; i < num_pixels; i++)
+        {
+            const uint8_t* sample = data + pos + i * sample_bytes;
+            int value = sample_bytes == 2 ? sample[0] << 8 | sample[1] : sample[0];
+            image->pixels[i] = (uint8_t)(std::min(value, max_value) * 255 / max_value);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < num_pixels; i++)
+        {
+            int value = 0;
+            if (!ReadPgmNumber(data, size, &pos, &value))
+            {
+                printf("Truncated PGM\n");
+                return false;
+            }
+            image->pixels[i] = (uint8_t)(std::min(value, max_value) * 255 / max_value);
+        }
+    }
+    return true;
+}
+
+// Least significant bit first, as deflate packs everything but Huffman codes
+struct BitReader
+{
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+    uint32_t buffer = 0;
+    int count = 0;
+    bool overrun = false;
+
+    uint32_t Bits(int n)
+    {
+        while (count < n)
+        {
+            uint32_t byte = 0;
+            if (pos < size)
+                byte = data[pos++];
+            else
+                overrun = true;
+            buffer |= byte << count;
+            count += 8;
+        }
+        uint32_t value = buffer & ((1u << n) - 1);
+        buffer >>= n;
+        count -= n;
+        return value;
+    }
+};
+
+// Canonical Huffman code, decoded one bit at a time
+struct Huffman
+{
+    uint16_t counts[16];   // Codes of each length
+    uint16_t symbols[288]; // Ordered by code
+
+    bool Build(const uint8_t* lengths, int num_symbols)
+    {
+        memset(counts, 0, sizeof(counts));
+        for (int i = 0; i < num_symbols; i++)
+            counts[lengths[i]]++;
+        counts[0] = 0;
+        int left = 1;
+        for (int len = 1; len < 16; len++)
+        {
+            left = (left << 1) - counts[len];
+            if (left < 0)
+                return false;
+        }
+        uint16_t offsets[16] = {};
+        for (int len = 1; len < 15; len++)
+            offsets[len + 1] = offsets[len] + counts[len];
+        for (int i = 0; i < num_symbols; i++)
+        {
+            if (lengths[i] != 0)
+                symbols[offsets[lengths[i]]++] = (uint16_t)i;
+        }
+        return true;
+    }
+
+    int Decode(BitReader& in) const
+    {
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len < 16; len++)
+        {
+            code |= (int)in.Bits(1);
+            int count = counts[len];
+            if (code - first < count)
+                return symbols[index + code - first];
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+// Base values and extra bits of the length and distance codes (RFC 1951, 3.2.5)
+static const uint16_t kLengthBase[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11,  13,
+                                         15, 17, 19, 23,  27,  31,  35,  43,  51,  59,
+                                         67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                         2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t kDistanceBase[30] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+    193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Code lengths of a dynamic block (RFC 1951, 3.2.7)
+static bool ReadDynamicCodes(BitReader& in, Huffman* literals, Huffman* distances)
+{
+    static const uint8_t kOrder[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                       11, 4,  12, 3, 13, 2, 14, 1, 15};
+    const int num_literals = (int)in.Bits(5) + 257;
+    const int num_distances = (int)in.Bits(5) + 1;
+    const int num_code_lengths = (int)in.Bits(4) + 4;
+    if (num_literals > 286 || num_distances > 30)
+        return false;
+
+    uint8_t lengths[286 + 30] = {};
+    for (int i = 0; i < num_code_lengths; i++)
+        lengths[kOrder[i]] = (uint8_t)in.Bits(3);
+    Huffman code_lengths;
+    if (!code_lengths.Build(lengths, 19))
+        return false;
+
+    memset(lengths, 0, sizeof(lengths));
+    for (int i = 0; i < num_literals + num_distances;)
+    {
+        int symbol = code_lengths.Decode(in);
+        if (symbol < 0 || in.overrun)
+            return false;
+        if (symbol < 16)
+        {
+            lengths[i++] = (uint8_t)symbol;
+            continue;
+        }
+        uint8_t value = 0;
+        int repeat;
+        if (symbol == 16)
+        {
+            if (i == 0)
+                return false;
+            value = lengths[i - 1];
+            repeat = 3 + (int)in.Bits(2);
+        }
+        else
+        {
+            repeat = symbol == 17 ? 3 + (int)in.Bits(3) : 11 + (int)in.Bits(7);
+        }
+        if (i + repeat > num_literals + num_distances)
+            return false;
+        while (repeat-- > 0)
+            lengths[i++] = value;
+    }
+    return literals->Build(lengths, num_literals) &&
+           distances->Build(lengths + num_literals, num_distances);
+}
+
+// Raw deflate stream (RFC 1951), appended to out
+static bool Inflate(const uint8_t* data, size_t size, std::vector<uint8_t>* out)
+{
+    BitReader in = {data, size};
+    bool last;
+    do
+    {
+        last = in.Bits(1) != 0;
+        const uint32_t type = in.Bits(2);
+        if (type == 0)
+        {
+            // Stored: byte aligned, the partly read byte is dropped
+            in.buffer = 0;
+            in.count = 0;
+            if (size - in.pos < 4)
+                return false;
+            const uint32_t length = data[in.pos] | data[in.pos + 1] << 8;
+            const uint32_t inverted = data[in.pos + 2] | data[in.pos + 3] << 8;
+            in.pos += 4;
+            if ((length ^ 0xFFFF) != inverted || size - in.pos < length)
+                return false;
+            out->insert(out->end(), data + in.pos, data + in.pos + length);
+            in.pos += length;
+            continue;
+        }
+
+        Huffman literals, distances;
+        if (type == 1)
+        {
+            uint8_t lengths[288];
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + 288, 8);
+            literals.Build(lengths, 288);
+            std::fill(lengths, lengths + 30, 5);
+            distances.Build(lengths, 30);
+        }
+        else if (type != 2 || !ReadDynamicCodes(in, &literals, &distances))
+        {
+            return false;
+        }
+
+        for (;;)
+        {
+            int symbol = literals.Decode(in);
+            if (symbol < 0 || in.overrun)
+                return false;
+            if (symbol < 256)
+            {
+                out->push_back((uint8_t)symbol);
+                continue;
+            }
+            if (symbol == 256)
+                break;
+            symbol -= 257;
+            if (symbol >= 29)
+                return false;
+            const int length = kLengthBase[symbol] + (int)in.Bits(kLengthExtra[symbol]);
+            const int code = distances.Decode(in);
+            if (code < 0 || code >= 30)
+                return false;
+            const size_t distance = kDistanceBase[code] + in.Bits(kDistanceExtra[code]);
+            if (distance > out->size())
+                return false;
+            // Byte by byte, the copy may overlap what it produces
+            size_t from = out->size() - distance;
+            for (int k = 0; k < length; k++)
+            {
+                uint8_t byte = (*out)[from + k];
+                out->push_back(byte);
+            }
+        }
+    } while (!last);
+    return !in.overrun;
+}
+
+static uint32_t ReadBigEndian32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint8_t Luminance(int r, int g, int b)
+{
+    return (uint8_t)((299 * r + 587 * g + 114 * b + 500) / 1000);
+}
+
+bool DecodePng(const uint8_t* data, size_t size, GrayImage* image)
+{
+    static const uint8_t kSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if (size < 8 || memcmp(data, kSignature, 8) != 0)
+    {
+        printf("Not a PNG file\n");
+        return false;
+    }
+
+    int width = 0, height = 0, depth = 0, color_type = 0, interlace = 0;
+    std::vector<uint8_t> palette, compressed;
+    for (size_t pos = 8; size - pos >= 12;)
+    {
+        const uint32_t length = ReadBigEndian32(data + pos);
+        const uint8_t* type = data + pos + 4;
+        const uint8_t* chunk = data + pos + 8;
+        if (length > size - pos - 12)
+            break;
+        if (memcmp(type, "IHDR", 4) == 0 && length >= 13)
+        {
+            width = (int)ReadBigEndian32(chunk);
+            height = (int)ReadBigEndian32(chunk + 4);
+            depth = chunk[8];
+            color_type = chunk[9];
+            interlace = chunk[12];
+        }
+        else if (memcmp(type, "PLTE", 4) == 0)
+        {
+            palette.assign(chunk, chunk + length);
+        }
+        else if (memcmp(type, "IDAT", 4) == 0)
+        {
+            compressed.insert(compressed.end(), chunk, chunk + length);
+        }
+        else if (memcmp(type, "IEND", 4) == 0)
+        {
+            break;
+        }
+        pos += 12 + length;
+    }
+
+    // Gray, -, RGB, palette, gray and alpha, -, RGBA
+    static const int kChannels[7] = {1, 0, 3, 1, 2, 0, 4};
+    const int channels = color_type < 7 ? kChannels[color_type] : 0;
+    if (width <= 0 || height <= 0 || width > 1 << 16 || height > 1 << 16 || channels == 0 ||
+        (depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16))
+    {
+        printf("Unsupported PNG format\n");
+        return false;
+    }
+    if (interlace != 0)
+    {
+        printf("Interlaced PNGs are not supported\n");
+        return false;
+    }
+
+    // zlib wrapper: a two byte header, deflate data and a checksum that is not verified
+    std::vector<uint8_t> raw;
+    const size_t bits_per_pixel = (size_t)channels * depth;
+    const size_t stride = ((size_t)width * bits_per_pixel + 7) / 8;
+    if (compressed.size() < 2 || (compressed[0] & 0x0F) != 8 ||
+        !Inflate(compressed.data() + 2, compressed.size() - 2, &raw) ||
+        raw.size() < (size_t)height * (stride + 1))
+    {
+        printf("Corrupt PNG data\n");
+        return false;
+    }
+
+    image->width = width;
+    image->height = height;
+    image->pixels.resize((size_t)width * height);
+    const size_t bpp = std::max<size_t>(bits_per_pixel / 8, 1);
+    const int max_sample = (1 << depth) - 1;
+    std::vector<uint8_t> previous(stride, 0), row(stride);
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* src = raw.data() + (size_t)y * (stride + 1);
+        const uint8_t filter = *src++;
+        for (size_t i = 0; i < stride; i++)
+        {
+            const int a = i >= bpp ? row[i - bpp] : 0;
+            const int b = previous[i];
+            const int c = i >= bpp ? previous[i - bpp] : 0;
+            // None, sub, up, average, Paeth
+            int predicted = 0;
+            if (filter == 1)
+            {
+                predicted = a;
+            }
+            else if (filter == 2)
+            {
+                predicted = b;
+            }
+            else if (filter == 3)
+            {
+                predicted = (a + b) / 2;
+            }
+            else if (filter == 4)
+            {
+                const int p = a + b - c;
+                const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                predicted = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+            }
+            row[i] = (uint8_t)(src[i] + predicted);
+        }
+
+        for (int x = 0; x < width; x++)
+        {
+            // Sample k of the pixel, 8 bits for depth 8 and 16, the raw value below
+            auto sample = [&](int k) -> int {
+                const size_t index = (size_t)x * channels + k;
+                if (depth >= 8)
+                    return row[index * (depth / 8)];
+                const size_t bit = index * depth;
+                return row[bit / 8] >> (8 - depth - bit % 8) & max_sample;
+            };
+            auto gray = [&](int k) { return depth < 8 ? sample(k) * 255 / max_sample : sample(k); };
+            uint8_t value = 0;
+            if (color_type == 0)
+            {
+                value = (uint8_t)gray(0);
+            }
+            else if (color_type == 2)
+            {
+                value = Luminance(sample(0), sample(1), sample(2));
+            }
+            else if (color_type == 3)
+            {
+                const size_t entry = (size_t)sample(0) * 3;
+                if (entry + 2 < palette.size())
+                    value = Luminance(palette[entry], palette[entry + 1], palette[entry + 2]);
+            }
+            else if (color_type == 4)
+            {
+                value = sample(1) < 128 ? 255 : (uint8_t)sample(0);
+            }
+            else
+            {
+                value = sample(3) < 128 ? 255 : Luminance(sample(0), sample(1), sample(2));
+            }
+            image->pixels[(size_t)y * width + x] = value;
+        }
+        std::swap(previous, row);
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// 8-bit grayscale image, rows from the top
+struct GrayImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+// Binary or plain PGM (P5, P2), 8 or 16 bits per sample, scaled to 0-255
+bool DecodePgm(const uint8_t* data, size_t size, GrayImage* image);
+
+// Non-interlaced PNG of any color type and bit depth, converted to luminance. Pixels less than
+// half opaque become white.
+bool DecodePng(const uint8_t* data, size_t size, GrayImage* image);
@@ -0,0 +1,109 @@
+#include "Lattice.h"
+
+#include <algorithm>
+
+const char* CollisionName(Collision collision)
+{
+    const char* kNames[] = {"BGK", "TRT", "MRT"};
+    return kNames[(int)collision];
+}
+
+template <class L, class T>
+static void InitRows(T* f, const uint32_t* solid_cells, const SimParams& params, int depth,
+                     int row_begin, int row_end)
+{
+    const PopulationLayout layout(params, depth, L::kNumVelocities);
+    for (int row = row_begin; row < row_end; row++)
+    {
+        for (int x = 0; x < params.width; x++)
+        {
+            int cell = row * params.width + x;
+            float u[L::kDimensions] = {};
+            u[0] = IsSolid(solid_cells, cell) ? 0.0f : params.U0;
+            for (int i = 0; i < L::kNumVelocities; i++)
+            {
+                StorePopulation<L>(f, layout.Index(cell, i), i,
+                                   LatticeEquilibrium<L>(i, 1.0f, u));
+            }
+        }
+    }
+}
+
+template <class L>
+void InitLatticePopulations(void* f, const uint32_t* solid_cells, const SimParams& params,
+                            int depth, int row_begin, int row_end)
+{
+    if (params.precision == Precision::FP16)
+        InitRows<L>((uint16_t*)f, solid_cells, params, depth, row_begin, row_end);
+    else
+        InitRows<L>((float*)f, solid_cells, params, depth, row_begin, row_end);
+}
+
+template void InitLatticePopulations<D2Q9>(void*, const uint32_t*, const SimParams&, int, int,
+                                           int);
+template void InitLatticePopulations<D3Q19>(void*, const uint32_t*, const SimParams&, int, int,
+                                            int);
+template void InitLatticePopulations<D3Q27>(void*, const uint32_t*, const SimParams&, int, int,
+                                            int);
+
+void InitPopulations(void* f, const uint32_t* solid_cells, const SimParams& params, int y_begin,
+                     int y_end)
+{
+    InitLatticePopulations<D2Q9>(f, solid_cells, params, 1, y_begin, y_end);
+}
+
+void CellMacroscopic(const void* f, const SimParams& params, int parity, int x, int y,
+                     float* density, float* ux, float* uy)
+{
+    const PopulationLayout layout(params);
+    const size_t cell = (size_t)y * params.width + x;
+    *density = 0.0f;
+    *ux = 0.0f;
+    *uy = 0.0f;
+    for (int i = 0; i < kNumVelocities; i++)
+    {
+        float fi;
+        if (parity == 1)
+        {
+            // Pushed into the neighbor's opposite slot by the last (even) step
+            size_t target = cell + kVelocities[i][1] * params.width + kVelocities[i][0];
+            fi = LoadPopulation(f, layout, target, kOpposite[i]);
+        }
+        else
+        {
+            fi = LoadPopulation(f, layout, cell, i);
+        }
+        *density += fi;
+        *ux += fi * kVelocities[i][0];
+        *uy += fi * kVelocities[i][1];
+    }
+    *ux /= *density;
+    *uy /= *density;
+}
+
+void ObstacleForce(const void* f, const SimParams& params, const uint32_t* solid_cells,
+                   int y_begin, int y_end, float* fx, float* fy)
+{
+    const PopulationLayout layout(params);
+    // Edge cells are left to the equilibrium boundary and never bounce anything back
+    for (int y = std::max(y_begin, 1); y < std::min(y_end, params.height - 1); y++)
+    {
+        for (int x = 1; x < params.width - 1; x++)
+        {
+            const int cell = y * params.width + x;
+            if (IsSolid(solid_cells, cell))
+                continue;
+            for (int i = 0; i < kNumVelocities; i++)
+            {
+                const int wall = cell + kVelocities[i][1] * params.width + kVelocities[i][0];
+                if (i == 4 || !IsSolid(solid_cells, wall))
+                    continue;
+                // The population leaving into the wall and the one it sends back, see kForceShader
+                float sum = LoadPopulation(f, layout, cell, i) +
+                            LoadPopulation(f, layout, wall, kOpposite[i]);
+                *fx += kVelocities[i][0] * sum;
+                *fy += kVelocities[i][1] * sum;
+            }
+        }
+    }
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Half.h"
+#include "LatticeModel.h"
+
+// D2Q9 model of the 2D engine, in the same order as the tables in kComputeShader
+const int kNumVelocities = D2Q9::kNumVelocities;
+inline constexpr const auto& kVelocities = D2Q9::kVelocities;
+inline constexpr const auto& kWeights = D2Q9::kWeights;
+inline constexpr const auto& kOpposite = D2Q9::kOpposite;
+
+// How populations are stored. AoS interleaves the 9 populations of a cell (f[cell * 9 + i]),
+// SoA stores one plane per direction (f[i * plane_stride + cell]) so that neighbouring cells
+// are contiguous.
+enum class Layout
+{
+    AoS,
+    SoA
+};
+
+// Storage type of the populations, arithmetic is always fp32. FP16 keeps f_i - w_i, which stays
+// close to zero where halves are the most precise.
+enum class Precision
+{
+    FP32,
+    FP16
+};
+
+// Collision operator. BGK relaxes every population towards equilibrium at 1 / tau. TRT relaxes
+// the even part of each pair (f_i, f_opp(i)) at 1 / tau and the odd part, the heat flux, at
+// kHeatFluxRate. MRT (Lallemand and Luo) relaxes the orthogonal moments separately: the stresses
+// at 1 / tau, the heat fluxes at kHeatFluxRate and the energy modes at their own fixed rates.
+// Damping the non-hydrodynamic modes independently of tau keeps them stable closer to 0.5.
+enum class Collision
+{
+    BGK,
+    TRT,
+    MRT
+};
+
+const char* CollisionName(Collision collision);
+
+// Relaxation rates of the modes that do not set the viscosity, from Lallemand and Luo. A rate tied
+// to tau through the TRT magic parameter instead (1/4) goes towards zero as tau approaches 0.5,
+// and leaves the heat flux undamped exactly where stability is needed.
+const float kHeatFluxRate = 1.9f;
+const float kMrtRateE = 1.64f;
+const float kMrtRateEps = 1.54f;
+
+struct SimParams
+{
+    int width;
+    int height;
+    float U0;  // Inflow velocity, also applied on all domain edges
+    float tau; // Relaxation time of the shear stresses, 3 nu + 1/2
+    Layout layout = Layout::AoS;
+    // AA-pattern streaming in one population buffer. Even steps pull from the neighbors and write
+    // each result into the neighbor's opposite slot, odd steps read and write only the cell's own
+    // slots. Between an even and an odd step every population sits reversed in the slot
+    // f[cell, opp(i)] of the cell it streams into.
+    bool in_place = false;
+    Precision precision = Precision::FP32;
+    Collision collision = Collision::BGK;
+    // Smagorinsky constant of the LES subgrid model, 0 without it. Each cell relaxes the stresses
+    // at a local tau that adds the eddy viscosity Cs^2 |S| of its strain rate, taken from the
+    // non-equilibrium stress of the collision, so that Re beyond the grid's resolution stays
+    // stable. 0.1 to 0.2 are the usual values.
+    float smagorinsky = 0.0f;
+};
+
+struct PopulationLayout
+{
+    Layout layout;
+    Precision precision;
+    size_t num_cells;
+    size_t plane_stride; // Cells per plane, padded to 64 populations in SoA
+    int num_velocities;
+
+    // depth planes of the grid and num_velocities populations per cell, for the 3D lattices
+    explicit PopulationLayout(const SimParams& params, int depth = 1,
+                              int num_velocities = kNumVelocities)
+        : layout(params.layout), precision(params.precision),
+          num_cells((size_t)params.width * params.height * depth),
+          plane_stride(params.layout == Layout::SoA ? (num_cells + 63) & ~(size_t)63 : num_cells),
+          num_velocities(num_velocities)
+    {
+    }
+
+    size_t Index(size_t cell, int i) const
+    {
+        return layout == Layout::SoA ? i * plane_stride + cell : cell * num_velocities + i;
+    }
+
+    // Number of populations in a population buffer, including padding
+    size_t Size() const
+    {
+        return plane_stride * num_velocities;
+    }
+
+    size_t ElementBytes() const
+    {
+        return precision == Precision::FP16 ? sizeof(uint16_t) : sizeof(float);
+    }
+    size_t Bytes() const
+    {
+        return Size() * ElementBytes();
+    }
+};
+
+// Population i of lattice L stored at f[index], for either storage type
+template <class L = D2Q9> inline float LoadPopulation(const float* f, size_t index, int)
+{
+    return f[index];
+}
+template <class L = D2Q9> inline float LoadPopulation(const uint16_t* f, size_t index, int i)
+{
+    return HalfToFloat(f[index]) + L::kWeights[i];
+}
+template <class L = D2Q9> inline void StorePopulation(float* f, size_t index, int, float value)
+{
+    f[index] = value;
+}
+template <class L = D2Q9>
+inline void StorePopulation(uint16_t* f, size_t index, int i, float value)
+{
+    f[index] = FloatToHalf(value - L::kWeights[i]);
+}
+
+// Population i of cell in a buffer of either precision
+inline float LoadPopulation(const void* f, const PopulationLayout& layout, size_t cell, int i)
+{
+    if (layout.precision == Precision::FP16)
+        return LoadPopulation((const uint16_t*)f, layout.Index(cell, i), i);
+    return LoadPopulation((const float*)f, layout.Index(cell, i), i);
+}
+
+// Equilibrium of velocity i of lattice L, u holding its L::kDimensions components
+template <class L> inline float LatticeEquilibrium(int i, float density, const float* u)
+{
+    float cu = 0.0f;
+    float usqr = 0.0f;
+    for (int d = 0; d < L::kDimensions; d++)
+    {
+        cu += L::kVelocities[i][d] * u[d];
+        usqr += u[d] * u[d];
+    }
+    return L::kWeights[i] * density * (1.0f + 3.0f * cu + 4.5f * cu * cu - 1.5f * usqr);
+}
+
+inline float Equilibrium(int i, float density, float ux, float uy)
+{
+    const float u[2] = {ux, uy};
+    return LatticeEquilibrium<D2Q9>(i, density, u);
+}
+
+inline bool IsSolid(const uint32_t* solid_cells, int cell)
+{
+    return (solid_cells[cell / 32] & (1u << (cell % 32))) != 0u;
+}
+
+// Fills rows [y_begin, y_end) of f (PopulationLayout::Bytes()) with the initial state: uniform
+// flow at U0 for fluid cells, fluid at rest inside solids.
+void InitPopulations(void* f, const uint32_t* solid_cells, const SimParams& params, int y_begin,
+                     int y_end);
+// The same for lattice L over depth planes of height rows, rows [row_begin, row_end) of them
+template <class L>
+void InitLatticePopulations(void* f, const uint32_t* solid_cells, const SimParams& params,
+                            int depth, int row_begin, int row_end);
+
+// Density and velocity of cell (x, y) in a population buffer after a step that left parity as
+// the parity of the next one, see SimParams::in_place. In place with parity 1, only valid away
+// from the domain edges.
+void CellMacroscopic(const void* f, const SimParams& params, int parity, int x, int y,
+                     float* density, float* ux, float* uy);
+
+// Adds the momentum exchange force on the solid cells over the fluid-solid links of rows
+// [y_begin, y_end) to fx and fy, in lattice units, like kForceShader. Valid after either parity.
+void ObstacleForce(const void* f, const SimParams& params, const uint32_t* solid_cells,
+                   int y_begin, int y_end, float* fx, float* fy);
+
+// Residual of the velocity field: the RMS change of u over the interior fluid cells since the
+// previous sample, relative to the RMS of u, per step. du2 and u2 are the sums of |u - u_prev|^2
+// and |u|^2, steps the steps between the two samples. Infinite without a previous sample.
+inline double VelocityResidual(double du2, double u2, uint64_t steps)
+{
+    if (steps == 0 || u2 <= 0.0)
+        return HUGE_VAL;
+    return sqrt(du2 / u2) / (double)steps;
+}
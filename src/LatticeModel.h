@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+
+// Velocity sets as compile-time tables. Lattice<D, Q> holds the Q velocities of the DdQq model
+// with components in {-1, 0, 1}, ordered z slowest then y from +1 down and x from -1 up; the
+// weight of each velocity depends only on |c|^2. In D2Q9 this is the order of the tables in the
+// shaders, with the rest velocity in the middle and opp(i) = 8 - i.
+template <int D, int Q> struct Lattice
+{
+    static_assert((D == 2 && Q == 9) || (D == 3 && (Q == 19 || Q == 27)),
+                  "Lattice is one of D2Q9, D3Q19 and D3Q27");
+
+    static constexpr int kDimensions = D;
+    static constexpr int kNumVelocities = Q;
+    static constexpr float kSoundSpeed2 = 1.0f / 3.0f;
+
+    using Velocity = std::array<int, D>;
+
+    static constexpr std::array<Velocity, Q> kVelocities = []() {
+        // D3Q19 leaves out the corners, the others keep the whole cube
+        const int max_norm2 = Q == 19 ? 2 : D;
+        std::array<Velocity, Q> velocities = {};
+        int n = 0;
+        for (int z = D == 3 ? 1 : 0; z >= (D == 3 ? -1 : 0); z--)
+        {
+            for (int y = 1; y >= -1; y--)
+            {
+                for (int x = -1; x <= 1; x++)
+                {
+                    if (x * x + y * y + z * z > max_norm2)
+                        continue;
+                    velocities[n][0] = x;
+                    velocities[n][1] = y;
+                    if constexpr (D == 3)
+                        velocities[n][2] = z;
+                    n++;
+                }
+            }
+        }
+        return velocities;
+    }();
+
+    static constexpr std::array<float, Q> kWeights = []() {
+        // By |c|^2
+        constexpr float kD2Q9[] = {4.0f / 9, 1.0f / 9, 1.0f / 36};
+        constexpr float kD3Q19[] = {1.0f / 3, 1.0f / 18, 1.0f / 36};
+        constexpr float kD3Q27[] = {8.0f / 27, 2.0f / 27, 1.0f / 54, 1.0f / 216};
+        const float* by_norm = D == 2 ? kD2Q9 : Q == 19 ? kD3Q19 : kD3Q27;
+        std::array<float, Q> weights = {};
+        for (int i = 0; i < Q; i++)
+        {
+            int norm2 = 0;
+            for (int d = 0; d < D; d++)
+                norm2 += kVelocities[i][d] * kVelocities[i][d];
+            weights[i] = by_norm[norm2];
+        }
+        return weights;
+    }();
+
+    static constexpr std::array<int, Q> kOpposite = []() {
+        std::array<int, Q> opposite = {};
+        for (int i = 0; i < Q; i++)
+        {
+            for (int j = 0; j < Q; j++)
+            {
+                bool reversed = true;
+                for (int d = 0; d < D; d++)
+                    reversed = reversed && kVelocities[j][d] == -kVelocities[i][d];
+                if (reversed)
+                    opposite[i] = j;
+            }
+        }
+        return opposite;
+    }();
+
+    // Index of the rest velocity
+    static constexpr int kRest = Q / 2;
+};
+
+using D2Q9 = Lattice<2, 9>;
+using D3Q19 = Lattice<3, 19>;
+using D3Q27 = Lattice<3, 27>;
@@ -13,252 +13,73 @@
 #include <imgui/imgui_impl_glfw.h>
 #include <imgui/imgui_impl_opengl3.h>
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <filesystem>
+#include <float.h>
 #include <vector>
+#include <string>
 #include <utility>
 
 #include "OpenGLHelpers.h"
+#include "Checkpoint.h"
+#include "Convergence.h"
+#include "Geometry.h"
+#include "GeometryImport.h"
+#include "GpuReadback.h"
+#include "GpuSolver.h"
+#include "Lattice.h"
+#include "Shaders.h"
+#include "ThreadPool.h"
+
+// Last kSize samples of a statistic, as a ring buffer for ImGui::PlotLines
+struct History
+{
+    static const int kSize = 240;
+    float values[kSize] = {};
+    int offset = 0;
 
-const char* kComputeShader = R"glsl(
-#version 460 core
-
-layout(local_size_x = 16, local_size_y = 16) in;
-
-layout(std430, binding = 0) buffer DF_In {
-    float f_in[];
-};
-
-layout(std430, binding = 1) buffer DF_Out {
-    float f_out[];
-};
-
-layout(std430, binding = 2) buffer SolidCells {
-    uint solid_bits[];
-};
-
-uniform int width;
-uniform int height;
-uniform float U0;
-uniform float tau;
-
-const ivec2 velocities[9] = ivec2[9](
-    ivec2(-1, 1), ivec2(0, 1), ivec2(1, 1),
-    ivec2(-1, 0), ivec2(0, 0), ivec2(1, 0),
-    ivec2(-1, -1), ivec2(0, -1), ivec2(1, -1)
-);
-
-const float weights[9] = float[9](
-    1.0f/36, 1.0f/9, 1.0f/36,
-    1.0f/9, 4.0f/9, 1.0f/9,
-    1.0f/36, 1.0f/9, 1.0f/36
-);
-
-const int opp[9] = int[9](8, 7, 6, 5, 4, 3, 2, 1, 0);
-
-bool isSolid(int x, int y) {
-    int bit_index = y * width + x;
-    uint word_index = bit_index / 32;
-    uint bit_offset = bit_index % 32;
-    return (solid_bits[word_index] & (1u << bit_offset)) != 0u;
-}
-
-void main() {
-    ivec2 gid = ivec2(gl_GlobalInvocationID.xy);
-    int index = gid.y * width + gid.x;
-
-    if (isSolid(gid.x, gid.y)) {
-        // Bounce-back boundary condition for solid
-        for (int i = 0; i < 9; i++) {
-            f_out[index * 9 + opp[i]] = f_in[index * 9 + i];
-        }
-        return;
-    }
-
-    // Streaming step (pull from neighbors)
-    float f[9];
-    for (int i = 0; i < 9; i++) {
-        ivec2 neighborPos = gid - velocities[i];
-        if (neighborPos.x > 0 && neighborPos.x < width - 1 && neighborPos.y > 0 && neighborPos.y < height - 1) {
-            int neighborIndex = neighborPos.y * width + neighborPos.x;
-            f[i] = f_in[neighborIndex * 9 + i];
-        } else {
-            // Equilibrium boundaries
-            if (neighborPos.x == 0 || neighborPos.x == width - 1 || neighborPos.y == 0 || neighborPos.y == height - 1) {
-                float density = 1.0;
-                vec2 velocity = vec2(U0, 0.0);
-                float velDotC = dot(vec2(velocities[i]), velocity);
-                float velSq = dot(velocity, velocity);
-                f[i] = weights[i] * density * (1.0 + 3.0 * velDotC +
-                                4.5 * velDotC * velDotC - 1.5 * velSq);
-            }
-        }
-    }
-
-    // Compute density and velocity
-    float density = 0.0;
-    vec2 velocity = vec2(0.0);
-    for (int i = 0; i < 9; i++) {
-        density += f[i];
-        velocity += f[i] * vec2(velocities[i]);
-    }
-    velocity /= density;
-
-    // Collision step
-    float feq[9];
-    for (int i = 0; i < 9; i++) {
-        float velDotC = dot(vec2(velocities[i]), velocity);
-        float velSq = dot(velocity, velocity);
-        feq[i] = weights[i] * density * (1.0 + 3.0 * velDotC + 4.5 * velDotC * velDotC - 1.5 * velSq);
-    }
-
-    for (int i = 0; i < 9; i++) {
-        f_out[index * 9 + i] = f[i] - (f[i] - feq[i]) / tau;
-    }
-}
-)glsl";
-
-const char* kFragmentShader = R"glsl(
-#version 460 core
-
-out vec4 FragColor;
-
-in vec2 TexCoords;
-
-// Simulation parameters
-uniform int width;
-uniform int height;
-uniform float U0; // Initial maximum speed for normalization
-
-layout(std430, binding = 1) buffer DF_In {
-    float f_in[];
-};
-
-layout(std430, binding = 2) buffer SolidCells {
-    uint solid_bits[];
-};
-
-// D2Q9 model velocities
-const vec2 velocities[9] = vec2[9](
-    vec2(-1, 1), vec2(0, 1), vec2(1, 1),
-    vec2(-1, 0), vec2(0, 0), vec2(1, 0),
-    vec2(-1, -1), vec2(0, -1), vec2(1, -1)
-);
-
-// Function to convert normalized values to RGB
-vec3 color_from_floats(float red, float green, float blue) {
-    return vec3(clamp(red, 0.0, 1.0), clamp(green, 0.0, 1.0), clamp(blue, 0.0, 1.0));
-}
-
-// Colorscale rainbow
-vec3 colorscale_rainbow(float x) {
-    x = clamp(6.0 * (1.0 - x), 0.0, 6.0);
-    vec3 color = vec3(0.0, 0.0, 0.0);
-
-    if (x < 1.2) {
-        color = vec3(1.0, x * 0.83333333, 0.0);
-    } else if (x < 2.0) {
-        color = vec3(2.5 - x * 1.25, 1.0, 0.0);
-    } else if (x < 3.0) {
-        color = vec3(0.0, 1.0, x - 2.0);
-    } else if (x < 4.0) {
-        color = vec3(0.0, 4.0 - x, 1.0);
-    } else if (x < 5.0) {
-        color = vec3(x * 0.4 - 1.6, 0.0, 3.0 - x * 0.5);
-    } else {
-        color = vec3(2.4 - x * 0.4, 0.0, 3.0 - x * 0.5);
-    }
-
-    return color;
-}
-
-// Colorscale iron
-vec3 colorscale_iron(float x) {
-    x = clamp(4.0 * (1.0 - x), 0.0, 4.0);
-    vec3 color = vec3(1.0, 0.0, 0.0);
-
-    if (x < 0.66666667) {
-        color.g = 1.0;
-        color.b = 1.0 - x * 1.5;
-    } else if (x < 2.0) {
-        color.g = 1.5 - x * 0.75;
-    } else if (x < 3.0) {
-        color.r = 2.0 - x * 0.5;
-        color.b = x - 2.0;
-    } else {
-        color.r = 2.0 - x * 0.5;
-        color.b = 4.0 - x;
-    }
-
-    return color;
-}
-
-void main() {
-    // Compute pixel coordinates
-    int x = int(TexCoords.x * float(width));
-    int y = int(TexCoords.y * float(height));
-
-    if (x >= width || y >= height)
+    void Push(float value)
     {
-        FragColor = vec4(0.0);
-        return;
-    }
-
-    int index = y * width + x;
-
-    bool solid = (solid_bits[(y * width + x) / 32] & (1u << ((y * width + x) % 32))) != 0u;
-    if (solid) {
-        FragColor = vec4(0.5, 0.5, 0.5, 1.0);  // Gray for solid
-        return;
+        values[offset] = value;
+        offset = (offset + 1) % kSize;
     }
 
-    float f[9];
-    for (int i = 0; i < 9; i++)
+    float Latest() const
     {
-        f[i] = f_in[index * 9 + i];
+        return values[(offset + kSize - 1) % kSize];
     }
 
-    float density = 0.0;
-    vec2 velocity = vec2(0.0);
-    for (int i = 0; i < 9; i++)
+    // The scale starts at zero unless scale_min is FLT_MAX, for signed statistics
+    void Plot(const char* label, float scale_min = 0.0f) const
     {
-        density += f[i];
-        velocity += f[i] * velocities[i];
-    }
-    velocity /= density;
-
-    float speed = length(velocity);
-
-    if (isinf(speed) || isinf(density)) {
-        FragColor = vec4(0.0, 0.0, 0.0, 1.0); // Black for invalid values
-        return;
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%.2f", Latest());
+        ImGui::PlotLines(label, values, kSize, offset, overlay, scale_min, FLT_MAX, ImVec2(0, 60));
     }
+};
 
-    float normalized_v = clamp(speed / U0, 0.0, 1.0);
-
-    // Choose one of the color scales (e.g., rainbow)
-    vec3 color = colorscale_rainbow(normalized_v);
-
-    // Alternatively, use the iron colorscale
-    // vec3 color = colorscale_iron(normalized_v);
-
-    // Output the final color
-    FragColor = vec4(color_from_floats(color.r, color.g, color.b), 1.0);
-}
-)glsl";
-
-const char* kVertexShader = R"glsl(
-#version 460 core
-
-layout(location = 0) in vec2 aPos;
-layout(location = 1) in vec2 aTexCoords;
-
-out vec2 TexCoords;
-
-void main()
+// Rainbow color scale from blue at 0 to red at 1
+static void RainbowColor(float v, uint8_t rgb[3])
 {
-    TexCoords = aTexCoords;
-    gl_Position = vec4(aPos, 0.0, 1.0);
+    float x = std::clamp(6.0f * (1.0f - v), 0.0f, 6.0f);
+    HMM_Vec3 color;
+    if (x < 1.2f)
+        color = HMM_V3(1.0f, x * 0.83333333f, 0.0f);
+    else if (x < 2.0f)
+        color = HMM_V3(2.5f - x * 1.25f, 1.0f, 0.0f);
+    else if (x < 3.0f)
+        color = HMM_V3(0.0f, 1.0f, x - 2.0f);
+    else if (x < 4.0f)
+        color = HMM_V3(0.0f, 4.0f - x, 1.0f);
+    else if (x < 5.0f)
+        color = HMM_V3(x * 0.4f - 1.6f, 0.0f, 3.0f - x * 0.5f);
+    else
+        color = HMM_V3(2.4f - x * 0.4f, 0.0f, 3.0f - x * 0.5f);
+    for (int c = 0; c < 3; c++)
+        rgb[c] = (uint8_t)(std::clamp(color.Elements[c], 0.0f, 1.0f) * 255.0f + 0.5f);
 }
-)glsl";
 
 // clang-format off
 float quadVertices[] = {
@@ -272,16 +93,6 @@ float quadVertices[] = {
 
 unsigned int quadIndices[] = {0, 1, 2, 0, 2, 3};
 
-inline bool isInTriangle(float x, float y, HMM_Vec2 v1, HMM_Vec2 v2, HMM_Vec2 v3)
-{
-    // Barycentric coordinate calculation
-    float d = (v2.Y - v3.Y) * (v1.X - v3.X) + (v3.X - v2.X) * (v1.Y - v3.Y);
-    float a = ((v2.Y - v3.Y) * (x - v3.X) + (v3.X - v2.X) * (y - v3.Y)) / d;
-    float b = ((v3.Y - v1.Y) * (x - v3.X) + (v1.X - v3.X) * (y - v3.Y)) / d;
-    float c = 1 - a - b;
-    return a >= 0 && a <= 1 && b >= 0 && b <= 1 && c >= 0 && c <= 1;
-}
-
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nCmdShow)
 {
     if (!glfwInit())
@@ -296,6 +107,17 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
 
     const int width = 512 * 4;
     const int height = 512;
+    // Population storage used by the compute and fragment shaders
+    const Layout layout = Layout::SoA;
+    // AA-pattern streaming in a single population buffer instead of ping-ponging two
+    const bool in_place = false;
+    // Half-precision population storage, see Precision
+    const Precision precision = Precision::FP32;
+    // Collision operator, TRT and MRT stay stable at a tau closer to 0.5
+    const Collision collision = Collision::BGK;
+    // Smagorinsky constant, 0 without the LES model. Around 0.17 keeps Re in the 10^4 to 10^5
+    // range stable on this grid.
+    const float smagorinsky = 0.0f;
     const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
     GLFWwindow* window = glfwCreateWindow(width, height, "CFD", nullptr, nullptr);
     if (window == nullptr)
@@ -322,45 +144,31 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init(glsl_version);
 
-    const int num_velocities = 9; // D2Q9 model
-
-    const HMM_Vec2 velocities[9] = {HMM_Vec2{-1, 1},  HMM_Vec2{0, 1},  HMM_Vec2{1, 1},
-                                    HMM_Vec2{-1, 0},  HMM_Vec2{0, 0},  HMM_Vec2{1, 0},
-                                    HMM_Vec2{-1, -1}, HMM_Vec2{0, -1}, HMM_Vec2{1, -1}};
-
-    const float weights[9] = {1.0f / 36.0f, 1.0f / 9.0f,  1.0f / 36.0f, 1.0f / 9.0f, 4.0f / 9.0f,
-                              1.0f / 9.0f,  1.0f / 36.0f, 1.0f / 9.0f,  1.0f / 36.0f};
-
-    GLuint ssbo[2];
-    glGenBuffers(2, ssbo);
-
-    size_t bufferSize = width * height * num_velocities * sizeof(float);
-
-    // SSBO for current distribution functions
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo[0]);
-    glBufferStorage(GL_SHADER_STORAGE_BUFFER, bufferSize, NULL, GL_DYNAMIC_STORAGE_BIT);
-
-    // SSBO for updated distribution functions
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo[1]);
-    glBufferStorage(GL_SHADER_STORAGE_BUFFER, bufferSize, NULL, GL_DYNAMIC_STORAGE_BIT);
-
-    GLuint compute_shader = glCreateShader(GL_COMPUTE_SHADER);
-    glShaderSource(compute_shader, 1, &kComputeShader, nullptr);
-    CompileShader(compute_shader);
-    GLuint compute_program = glCreateProgram();
-    glAttachShader(compute_program, compute_shader);
-    LinkProgram(compute_program);
-
     float U0 = 0.075f;            // Initial velocity slightly
     const float L = 128;          // Characteristic length
     const float Re = 100.0f;      // Reynolds number
     float nu = U0 * L / Re;       // kinematic viscosity
     float tau = 3.0f * nu + 0.5f; // relaxation time
 
-    // Initialize distribution functions with a uniform flow from left to right
-    float rho0 = 1.0f;
-    float ux0 = U0;
-    float uy0 = 0.0f;
+    SimParams sim_params = {width, height, U0, tau, layout, in_place, precision, collision};
+    sim_params.smagorinsky = smagorinsky;
+
+    // A checkpoint path on the command line resumes that run instead of starting from rest, an
+    // .svg, .pgm or .png path replaces the wedge with that geometry
+    std::string arg_path = lpCmdLine;
+    arg_path.erase(std::remove(arg_path.begin(), arg_path.end(), '"'), arg_path.end());
+    std::string extension = arg_path.substr(std::min(arg_path.rfind('.'), arg_path.size()));
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    const bool is_geometry = extension == ".svg" || extension == ".pgm" || extension == ".png";
+    MappedCheckpoint checkpoint;
+    if (!arg_path.empty() && !is_geometry && checkpoint.Open(arg_path.c_str()))
+    {
+        if (checkpoint.Params().width == width && checkpoint.Params().height == height)
+            sim_params = checkpoint.Params();
+        else
+            checkpoint.Close();
+    }
+    const PopulationLayout pop_layout(sim_params);
 
     float centerX = 380;
     float centerY = 512.0f / 2;
@@ -371,50 +179,32 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
     HMM_Vec2 v2 = {centerX + wingLength / 2, centerY - wingHeight / 2}; // bottom right
     HMM_Vec2 v3 = {centerX + wingLength / 2, centerY + wingHeight / 2}; // top right
 
-    std::vector<float> f_in(width * height * num_velocities);
-    std::vector<uint32_t> solid_cells((width * height + 31) / 32, 0);
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            int idx = (y * width + x) * num_velocities;
-
-            float ux, uy;
-            if (isInTriangle(x, y, v1, v2, v3))
-            {
-                ux = 0;
-                uy = 0;
-
-                int bit_index = y * width + x;
-                solid_cells[bit_index / 32] |= (1u << (bit_index % 32));
-            }
-            else
-            {
-                ux = ux0;
-                uy = uy0;
-            }
+    ThreadPool thread_pool;
 
-            // Calculate equilibrium distribution
-            for (int i = 0; i < num_velocities; i++)
-            {
-                float cu = velocities[i].X * ux + velocities[i].Y * uy;
-                float usqr = ux * ux + uy * uy;
-                f_in[idx + i] =
-                    weights[i] * rho0 * (1.0f + 3.0f * cu + 4.5f * cu * cu - 1.5f * usqr);
-            }
-        }
+    std::vector<uint32_t> solid_cells;
+    std::vector<uint8_t> f_in;
+    if (checkpoint.IsOpen())
+    {
+        solid_cells = checkpoint.SolidCells();
+    }
+    else
+    {
+        if (!is_geometry || !LoadGeometryMask(arg_path.c_str(), width, height, thread_pool,
+                                              "mask_cache", &solid_cells))
+            solid_cells = PolygonMask(width, height, {{v1, v2, v3}}, thread_pool);
+
+        // Initialize distribution functions with a uniform flow from left to right
+        f_in.resize(pop_layout.Bytes());
+        thread_pool.ParallelFor(height, [&](int y_begin, int y_end) {
+            InitPopulations(f_in.data(), solid_cells.data(), sim_params, y_begin, y_end);
+        });
     }
 
-    // Create and initialize the solid cells buffer
-    GLuint solid_buffer;
-    glGenBuffers(1, &solid_buffer);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, solid_buffer);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, solid_cells.size() * sizeof(uint32_t),
-                 solid_cells.data(), GL_STATIC_DRAW);
-
-    // Upload the initialized distribution functions to the GPU
-    glNamedBufferSubData(ssbo[0], 0, bufferSize, f_in.data());
-    glNamedBufferSubData(ssbo[1], 0, bufferSize, f_in.data());
+    // Uploaded straight from the mapped file when resuming
+    GpuSolver gpu(sim_params, solid_cells,
+                  checkpoint.IsOpen() ? checkpoint.Populations() : f_in.data(),
+                  checkpoint.IsOpen() ? checkpoint.Header().step_count : 0);
+    checkpoint.Close();
 
     GLuint quadVAO, quadVBO, quadEBO;
     glGenVertexArrays(1, &quadVAO);
@@ -443,38 +233,196 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
     glShaderSource(vertex_shader, 1, &kVertexShader, nullptr);
     CompileShader(vertex_shader);
     GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-
     glShaderSource(fragment_shader, 1, &kFragmentShader, nullptr);
     CompileShader(fragment_shader);
-    GLuint render_program = glCreateProgram();
+    Program render_program = CreateProgram({vertex_shader, fragment_shader});
+    glProgramUniform1i(render_program.id, render_program.Uniform("fields"), 0);
+    glProgramUniform1i(render_program.id, render_program.Uniform("colormap"), 1);
+
+    // The render only looks up the fields the last step of each frame wrote, so its cost no
+    // longer depends on the populations per cell
+    const int kColormapSize = 256;
+    uint8_t colormap_texels[kColormapSize][4];
+    for (int k = 0; k < kColormapSize; k++)
+    {
+        RainbowColor((k + 0.5f) / kColormapSize, colormap_texels[k]);
+        colormap_texels[k][3] = 255;
+    }
+    GLuint colormap;
+    glCreateTextures(GL_TEXTURE_1D, 1, &colormap);
+    glTextureStorage1D(colormap, 1, GL_RGBA8, kColormapSize);
+    glTextureSubImage1D(colormap, 0, 0, kColormapSize, GL_RGBA, GL_UNSIGNED_BYTE, colormap_texels);
+    glTextureParameteri(colormap, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(colormap, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(colormap, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+
+    // State that stays bound for the whole run, next to the SimParams block and the solid bitset
+    // bound by GpuSolver
+    glBindVertexArray(quadVAO);
 
-    glAttachShader(render_program, vertex_shader);
-    glAttachShader(render_program, fragment_shader);
-    LinkProgram(render_program);
+    // GPU time of the compute batch, the quad draw and ImGui, read back one frame late
+    GpuTimer compute_timer, render_timer, imgui_timer;
+    compute_timer.Create();
+    render_timer.Create();
+    imgui_timer.Create();
+    int timed_steps[2] = {}; // Steps in the batch behind each compute query
+
+    // Every cell update reads and writes 9 populations
+    const int64_t num_cells = (int64_t)width * height;
+    int64_t num_solid = 0;
+    for (uint32_t word : solid_cells)
+        num_solid += std::popcount(word);
+    const double bytes_per_update = 2.0 * kNumVelocities * pop_layout.ElementBytes();
+
+    History compute_ms, render_ms, imgui_ms, mlups_history;
+    float mlups = 0.0f, fluid_mlups = 0.0f, gbps = 0.0f;
+    bool log_csv = false;
+    FILE* csv = nullptr;
+
+    // Drag and lift coefficients, the force over the dynamic pressure on the characteristic
+    // length. Sampled every step, the plots show the latest sample of each frame.
+    const float force_scale = 1.0f / (0.5f * U0 * U0 * L);
+    gpu.SetForceSampling(true);
+    std::vector<ForceSample> forces;
+    History drag_history, lift_history;
+    bool log_forces = false;
+    FILE* forces_csv = nullptr;
+
+    // Residual every check_interval steps and the lift (then drag) coefficient of every force
+    // sample tell when the flow is steady or sheds periodically; stepping can stop there
+    const ConvergenceCriteria criteria;
+    ConvergenceMonitor monitor(criteria, 2);
+    std::vector<ResidualSample> residuals;
+    uint64_t last_residual = gpu.StepCount();
+    bool stop_when_converged = false;
+
+    // Simulation steps between rendered frames. In time budget mode the count follows the
+    // measured frame time so that a batch fills frame_budget_ms.
+    const int kMaxStepsPerFrame = 1000;
+    int steps_per_frame = 1;
+    bool use_time_budget = false;
+    float frame_budget_ms = 16.0f;
+    float budget_steps = 1.0f;
+    double last_frame_time = glfwGetTime();
+
+    // Checkpoints and field snapshots are copied into a readback ring behind the steps and
+    // written to disk by its consumer thread, neither stalls the frame. With autosave_steps > 0
+    // (snapshot_steps > 0), one is saved each time the step count crosses a multiple of it.
+    const char* kCheckpointPath = "checkpoint.cfd";
+    const char* kSnapshotDir = "snapshots";
+    enum ReadbackTag
+    {
+        kCheckpointTag,
+        kFieldsTag
+    };
+    std::atomic<bool> write_failed = false;
+    SnapshotReadback readback(pop_layout.Bytes(), 3, [&](const Snapshot& snapshot) {
+        bool ok;
+        if (snapshot.tag == kCheckpointTag)
+        {
+            ok = WriteCheckpoint(kCheckpointPath, sim_params, snapshot.step_count, snapshot.data,
+                                 solid_cells);
+        }
+        else
+        {
+            char path[64];
+            snprintf(path, sizeof(path), "%s/fields_%010llu.bin", kSnapshotDir,
+                     (unsigned long long)snapshot.step_count);
+            ok = WriteFieldSnapshot(path, sim_params, snapshot.step_count, snapshot.parity,
+                                    snapshot.data);
+        }
+        if (!ok)
+            write_failed.store(true, std::memory_order_relaxed);
+    });
+    int autosave_steps = 0;
+    uint64_t last_autosave = gpu.StepCount();
+    int snapshot_steps = 0;
+    uint64_t last_snapshot = gpu.StepCount();
 
     while (!glfwWindowShouldClose(window))
     {
-        glUseProgram(compute_program);
-        glUniform1i(glGetUniformLocation(compute_program, "width"), width);
-        glUniform1i(glGetUniformLocation(compute_program, "height"), height);
-        glUniform1f(glGetUniformLocation(compute_program, "U0"), U0);
-        glUniform1f(glGetUniformLocation(compute_program, "tau"), tau);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo[0]);      // f_in
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo[1]);      // f_out
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, solid_buffer); // solid cells
-        glDispatchCompute(width / 16, height / 16, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        double frame_time = glfwGetTime();
+        float frame_ms = (float)(frame_time - last_frame_time) * 1000.0f;
+        last_frame_time = frame_time;
+        if (use_time_budget && frame_ms > 0.0f)
+        {
+            budget_steps *= std::clamp(frame_budget_ms / frame_ms, 0.5f, 2.0f);
+            budget_steps = std::clamp(budget_steps, 1.0f, (float)kMaxStepsPerFrame);
+            steps_per_frame = (int)(budget_steps + 0.5f);
+        }
+
+        const bool stopped = stop_when_converged && monitor.Finished();
+        compute_timer.Begin();
+        if (!stopped)
+            gpu.Step(steps_per_frame, true);
+        timed_steps[compute_timer.current] = stopped ? 0 : steps_per_frame;
+        compute_timer.End();
+        if (gpu.StepCount() / criteria.check_interval != last_residual / criteria.check_interval)
+        {
+            gpu.SampleResidual();
+            last_residual = gpu.StepCount();
+        }
 
+        render_timer.Begin();
         glClear(GL_COLOR_BUFFER_BIT);
-        glUseProgram(render_program);
-        glUniform1i(glGetUniformLocation(render_program, "width"), width);
-        glUniform1i(glGetUniformLocation(render_program, "height"), height);
-        glUniform1f(glGetUniformLocation(render_program, "U0"), U0);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo[1]); // f_out
-        glBindVertexArray(quadVAO);
+        glUseProgram(render_program.id);
+        glBindTextureUnit(0, gpu.FieldsTexture());
+        glBindTextureUnit(1, colormap);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        render_timer.End();
 
-        std::swap(ssbo[0], ssbo[1]);
+        float ms;
+        if (compute_timer.Poll(&ms) && ms > 0.0f)
+        {
+            double updates = (double)timed_steps[compute_timer.current] * num_cells;
+            compute_ms.Push(ms);
+            mlups = (float)(updates / (ms * 1e3));
+            fluid_mlups = mlups * (float)(num_cells - num_solid) / num_cells;
+            gbps = (float)(updates * bytes_per_update / (ms * 1e6));
+            mlups_history.Push(mlups);
+
+            if (csv != nullptr)
+            {
+                fprintf(csv, "%llu,%d,%.4f,%.4f,%.4f,%.2f,%.2f,%.2f\n",
+                        (unsigned long long)gpu.StepCount(), timed_steps[compute_timer.current], ms,
+                        render_ms.Latest(), imgui_ms.Latest(), mlups, fluid_mlups, gbps);
+            }
+        }
+        if (render_timer.Poll(&ms))
+            render_ms.Push(ms);
+        if (imgui_timer.Poll(&ms))
+            imgui_ms.Push(ms);
+
+        forces.clear();
+        gpu.PollForces(&forces);
+        for (const ForceSample& sample : forces)
+        {
+            const float coefficients[2] = {sample.fy * force_scale, sample.fx * force_scale};
+            monitor.AddSignal(sample.step, coefficients);
+            if (forces_csv != nullptr)
+            {
+                fprintf(forces_csv, "%llu,%.6e,%.6e,%.6f,%.6f\n", (unsigned long long)sample.step,
+                        sample.fx, sample.fy, sample.fx * force_scale, sample.fy * force_scale);
+            }
+        }
+        if (!forces.empty())
+        {
+            drag_history.Push(forces.back().fx * force_scale);
+            lift_history.Push(forces.back().fy * force_scale);
+        }
+        residuals.clear();
+        gpu.PollResiduals(&residuals);
+        for (const ResidualSample& sample : residuals)
+            monitor.AddResidual(sample.step, sample.residual);
+
+        bool snapshot = snapshot_steps > 0 &&
+                        gpu.StepCount() / snapshot_steps != last_snapshot / snapshot_steps;
+        if (snapshot)
+        {
+            readback.Capture(gpu.Populations(), gpu.StepCount(), gpu.Parity(), kFieldsTag);
+            last_snapshot = gpu.StepCount();
+        }
+        readback.Poll();
 
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -482,16 +430,132 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
 
         ImGui::Begin("Dbg");
         ImGui::Text("FPS: %.0f", ImGui::GetIO().Framerate);
-        ImGui::Text("Tau: %.2f", tau);
+        ImGui::Text("Tau: %.2f (%s)", sim_params.tau, CollisionName(sim_params.collision));
+        if (sim_params.smagorinsky > 0.0f)
+            ImGui::Text("Smagorinsky Cs: %.2f", sim_params.smagorinsky);
+        ImGui::Text("Step: %llu", (unsigned long long)gpu.StepCount());
+        bool tiled = gpu.GetKernel() == GpuKernel::Tiled;
+        if (ImGui::Checkbox("Tiled kernel", &tiled))
+            gpu.SetKernel(tiled ? GpuKernel::Tiled : GpuKernel::Global);
+        bool sparse = gpu.Sparse();
+        if (ImGui::Checkbox("Sparse tiles", &sparse))
+            gpu.SetSparse(sparse);
+        if (sparse)
+        {
+            TileCounts tiles = gpu.GetTileCounts();
+            ImGui::Text("Tiles: %d active, %d quiescent, %d skipped", tiles.active, tiles.quiescent,
+                        tiles.skipped);
+        }
+        ImGui::Checkbox("Time budget", &use_time_budget);
+        if (use_time_budget)
+        {
+            ImGui::SliderFloat("Budget (ms)", &frame_budget_ms, 1.0f, 100.0f, "%.0f");
+            ImGui::Text("Steps/frame: %d", steps_per_frame);
+        }
+        else if (ImGui::SliderInt("Steps/frame", &steps_per_frame, 1, kMaxStepsPerFrame))
+        {
+            budget_steps = (float)steps_per_frame;
+        }
+
+        bool autosave = autosave_steps > 0 &&
+                        gpu.StepCount() / autosave_steps != last_autosave / autosave_steps;
+        if (ImGui::Button("Save checkpoint") || autosave)
+        {
+            readback.Capture(gpu.Populations(), gpu.StepCount(), gpu.Parity(), kCheckpointTag);
+            last_autosave = gpu.StepCount();
+        }
+        if (readback.Pending() > 0 || write_failed.load(std::memory_order_relaxed))
+        {
+            ImGui::SameLine();
+            ImGui::Text(readback.Pending() > 0 ? "Writing..." : "Write failed");
+        }
+        ImGui::InputInt("Autosave (steps)", &autosave_steps, 1000, 10000);
+        autosave_steps = std::max(autosave_steps, 0);
+        if (ImGui::InputInt("Field snapshots (steps)", &snapshot_steps, 100, 1000) &&
+            snapshot_steps > 0)
+        {
+            std::error_code error;
+            std::filesystem::create_directories(kSnapshotDir, error);
+        }
+        snapshot_steps = std::max(snapshot_steps, 0);
+        if (readback.Dropped() > 0)
+            ImGui::Text("Snapshots dropped: %d", readback.Dropped());
+
+        ImGui::Separator();
+        ImGui::Text("MLUPS: %.0f (fluid %.0f)", mlups, fluid_mlups);
+        ImGui::Text("Bandwidth: %.1f GB/s", gbps);
+        compute_ms.Plot("Compute ms");
+        render_ms.Plot("Render ms");
+        imgui_ms.Plot("ImGui ms");
+        mlups_history.Plot("MLUPS");
+        if (ImGui::Checkbox("Log timings.csv", &log_csv))
+        {
+            if (log_csv)
+            {
+                csv = fopen("timings.csv", "w");
+                if (csv != nullptr)
+                    fprintf(csv, "step,steps_per_frame,compute_ms,render_ms,imgui_ms,mlups,"
+                                 "fluid_mlups,gbps\n");
+                log_csv = csv != nullptr;
+            }
+            else
+            {
+                fclose(csv);
+                csv = nullptr;
+            }
+        }
+
+        ImGui::Separator();
+        bool sample_forces = gpu.ForceSampling();
+        if (ImGui::Checkbox("Sample forces", &sample_forces))
+            gpu.SetForceSampling(sample_forces);
+        drag_history.Plot("Cd", FLT_MAX);
+        lift_history.Plot("Cl", FLT_MAX);
+        ImGui::Text("Flow: %s since step %llu, residual %.2e",
+                    ConvergenceStateName(monitor.State()), (unsigned long long)monitor.StateStep(),
+                    monitor.LastResidual());
+        if (monitor.Period() > 0.0)
+        {
+            ImGui::Text("Period: %.0f steps, St %.4f, Cl amplitude %.4f", monitor.Period(),
+                        L / (monitor.Period() * U0), monitor.Amplitude());
+        }
+        ImGui::Checkbox("Stop when converged", &stop_when_converged);
+        ImGui::SameLine();
+        if (ImGui::Button("Reset convergence"))
+            monitor = ConvergenceMonitor(criteria, 2);
+        if (ImGui::Checkbox("Log forces.csv", &log_forces))
+        {
+            if (log_forces)
+            {
+                forces_csv = fopen("forces.csv", "w");
+                if (forces_csv != nullptr)
+                    fprintf(forces_csv, "step,fx,fy,cd,cl\n");
+                log_forces = forces_csv != nullptr;
+            }
+            else
+            {
+                fclose(forces_csv);
+                forces_csv = nullptr;
+            }
+        }
         ImGui::End();
 
         ImGui::Render();
+        imgui_timer.Begin();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        imgui_timer.End();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    if (csv != nullptr)
+        fclose(csv);
+    if (forces_csv != nullptr)
+        fclose(forces_csv);
+    // The last writes, while the context is still current
+    readback.Finish();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -3,6 +3,11 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
 
 #include <glad/gl.h>
 
@@ -40,6 +45,20 @@ static inline void CheckGLError(const char* file, const int line)
     }
 }
 
+// Sets the shader source with extra "#define" lines inserted right after its #version line
+static void ShaderSourceWithDefines(const GLuint shader, const char* source, const char* defines)
+{
+    const char* version = strstr(source, "#version");
+    assert(version != nullptr);
+    const char* body = strchr(version, '\n');
+    assert(body != nullptr);
+    body++;
+
+    const GLchar* strings[3] = {source, defines, body};
+    const GLint lengths[3] = {(GLint)(body - source), (GLint)strlen(defines), -1};
+    glShaderSource(shader, 3, strings, lengths);
+}
+
 static void CompileShader(const GLuint shader)
 {
     glCompileShader(shader);
@@ -76,4 +95,113 @@ static void LinkProgram(const GLuint program)
         assert(false);
         exit(1);
     }
-}
\ No newline at end of file
+}
+
+// Linked program with the locations of its active uniforms, reflected once at link time.
+// Members of uniform blocks are not listed, they live in a UniformBuffer.
+struct Program
+{
+    GLuint id = 0;
+    std::unordered_map<std::string, GLint> uniforms;
+
+    // -1 (ignored by glUniform*) if the program has no such active uniform
+    GLint Uniform(const char* name) const
+    {
+        auto it = uniforms.find(name);
+        return it != uniforms.end() ? it->second : -1;
+    }
+};
+
+static Program CreateProgram(std::initializer_list<GLuint> shaders)
+{
+    Program program;
+    program.id = glCreateProgram();
+    for (GLuint shader : shaders)
+        glAttachShader(program.id, shader);
+    LinkProgram(program.id);
+
+    GLint num_uniforms = 0;
+    glGetProgramInterfaceiv(program.id, GL_UNIFORM, GL_ACTIVE_RESOURCES, &num_uniforms);
+    for (GLint i = 0; i < num_uniforms; i++)
+    {
+        const GLenum props[2] = {GL_LOCATION, GL_NAME_LENGTH};
+        GLint values[2];
+        glGetProgramResourceiv(program.id, GL_UNIFORM, i, 2, props, 2, nullptr, values);
+        if (values[0] < 0)
+            continue;
+
+        std::string name(values[1], '\0');
+        glGetProgramResourceName(program.id, GL_UNIFORM, i, values[1], nullptr, name.data());
+        name.resize(strlen(name.c_str()));
+        program.uniforms[name] = values[0];
+    }
+    CheckGLError(__FILE__, __LINE__);
+    return program;
+}
+
+// Host copy of a std140 uniform block, bound once and re-uploaded only after it changed.
+// T must match the block layout in the shaders.
+template <class T> struct UniformBuffer
+{
+    GLuint id = 0;
+    T data = {};
+    bool dirty = true;
+
+    void Create(GLuint binding)
+    {
+        glCreateBuffers(1, &id);
+        glNamedBufferStorage(id, sizeof(T), nullptr, GL_DYNAMIC_STORAGE_BIT);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, id);
+    }
+
+    void Update()
+    {
+        if (!dirty)
+            return;
+        glNamedBufferSubData(id, 0, sizeof(T), &data);
+        dirty = false;
+    }
+};
+
+// GL_TIME_ELAPSED around a section of each frame. Two queries alternate so that a result is read
+// one frame after it was issued, when it is normally available, and Poll never waits for it.
+struct GpuTimer
+{
+    GLuint queries[2] = {};
+    bool issued[2] = {};
+    int current = 0;
+
+    void Create()
+    {
+        glCreateQueries(GL_TIME_ELAPSED, 2, queries);
+    }
+
+    void Begin()
+    {
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+    }
+
+    void End()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued[current] = true;
+        current ^= 1;
+    }
+
+    // Duration in milliseconds of the section issued the frame before the last End, if ready
+    bool Poll(float* ms)
+    {
+        const int previous = current;
+        if (!issued[previous])
+            return false;
+        GLint available = 0;
+        glGetQueryObjectiv(queries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries[previous], GL_QUERY_RESULT, &ns);
+        issued[previous] = false;
+        *ms = (float)(ns * 1e-6);
+        return true;
+    }
+};
@@ -0,0 +1,803 @@
+#pragma once
+
+// GLSL sources shared by the window and the headless tools. Compiled through
+// ShaderSourceWithDefines with the defines from ShaderDefines() in GpuSolver.h.
+
+inline const char* kComputeShader = R"glsl(
+#version 460 core
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+#ifdef FP16
+// f_i - w_i as halves, two per word, see Precision in Lattice.h
+#define POP_TYPE uint
+#else
+#define POP_TYPE float
+#endif
+
+layout(std430, binding = 0) buffer DF_In {
+    POP_TYPE f_in[];
+};
+
+#ifdef IN_PLACE
+// AA pattern in a single buffer, see SimParams::in_place. Even steps pull from the neighbors and
+// push the result back into the neighbors' opposite slots, odd steps read and write only the
+// cell's own slots.
+uniform int parity;
+#define f_out f_in
+#else
+layout(std430, binding = 1) buffer DF_Out {
+    POP_TYPE f_out[];
+};
+#endif
+
+layout(std430, binding = 2) buffer SolidCells {
+    uint solid_bits[];
+};
+
+#ifdef SPARSE
+// Work groups run the tiles listed by kTileShader: the active ones, or in the quiescent pass the
+// tiles no disturbance reaches before the next rebuild
+layout(std430, binding = 4) buffer TileLists {
+    uvec4 dispatch[2];
+    uint tile_list[];
+};
+uniform int quiescent_pass;
+#endif
+
+// Density, x and y velocity, and 1 in solid cells, written by the last step before a frame is
+// rendered when write_fields is set
+layout(rgba16f, binding = 0) uniform writeonly image2D fields_image;
+uniform int write_fields;
+
+// Shared by all programs, see SimUniforms
+layout(std140, binding = 0) uniform SimParams {
+    int width;
+    int height;
+    float U0; // Inflow speed, also used to normalize the color scale
+    float tau;
+    int plane_stride;
+};
+
+// Population addressing, see Layout in Lattice.h
+#ifdef LAYOUT_SOA
+#define POP(cell, i) ((i) * plane_stride + (cell))
+#else
+#define POP(cell, i) ((cell) * 9 + (i))
+#endif
+
+const ivec2 velocities[9] = ivec2[9](
+    ivec2(-1, 1), ivec2(0, 1), ivec2(1, 1),
+    ivec2(-1, 0), ivec2(0, 0), ivec2(1, 0),
+    ivec2(-1, -1), ivec2(0, -1), ivec2(1, -1)
+);
+
+const float weights[9] = float[9](
+    1.0f/36, 1.0f/9, 1.0f/36,
+    1.0f/9, 4.0f/9, 1.0f/9,
+    1.0f/36, 1.0f/9, 1.0f/36
+);
+
+const int opp[9] = int[9](8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+#ifdef COLLISION_MRT
+// Relaxed rows of the moment basis and their squared norms, see kMrtBasis in CpuCollision.h
+const int mrtBasis[54] = int[54](
+     2, -1,  2, -1, -4, -1,  2, -1,  2,
+     1, -2,  1, -2,  4, -2,  1, -2,  1,
+    -1,  0,  1,  2,  0, -2, -1,  0,  1,
+     1, -2,  1,  0,  0,  0, -1,  2, -1,
+     0, -1,  0,  1,  0,  1,  0, -1,  0,
+    -1,  0,  1,  0,  0,  0,  1,  0, -1
+);
+const float mrtNorms[6] = float[6](36.0, 36.0, 12.0, 12.0, 4.0, 4.0);
+#endif
+
+// Population stored in slot (cell, i) at POP(cell, i)
+float readPop(int slot, int i) {
+#ifdef FP16
+    vec2 pair = unpackHalf2x16(f_in[slot >> 1]);
+    return ((slot & 1) == 0 ? pair.x : pair.y) + weights[i];
+#else
+    return f_in[slot];
+#endif
+}
+
+bool isSolid(int x, int y) {
+    int bit_index = y * width + x;
+    uint word_index = bit_index / 32;
+    uint bit_offset = bit_index % 32;
+    return (solid_bits[word_index] & (1u << bit_offset)) != 0u;
+}
+
+// Equilibrium at the inflow density and velocity
+float freestream(int i) {
+    vec2 velocity = vec2(U0, 0.0);
+    float velDotC = dot(vec2(velocities[i]), velocity);
+    float velSq = dot(velocity, velocity);
+    return weights[i] * (1.0 + 3.0 * velDotC + 4.5 * velDotC * velDotC - 1.5 * velSq);
+}
+
+// First cell of the work group's 16x16 tile
+ivec2 tileOrigin() {
+#ifdef SPARSE
+    int tiles_x = width / 16;
+    int tile = int(tile_list[quiescent_pass * tiles_x * (height / 16) + int(gl_WorkGroupID.x)]);
+    return ivec2(tile % tiles_x, tile / tiles_x) * 16;
+#else
+    return ivec2(gl_WorkGroupID.xy) * 16;
+#endif
+}
+
+#ifdef TILED
+// Populations each cell of the work group pulls, gathered cooperatively from a one cell halo
+// around it so that consecutive invocations load consecutive addresses in either layout
+shared float tile_f[9][16 * 16];
+// Solid bits of the work group's rows; 16 aligned cells always share a word
+shared uint tile_solid[16];
+
+void loadTile(ivec2 origin) {
+    int local_index = int(gl_LocalInvocationIndex);
+    if (local_index < 16) {
+        int bit_index = (origin.y + local_index) * width + origin.x;
+        tile_solid[local_index] = solid_bits[bit_index / 32] >> (bit_index % 32);
+    }
+
+#ifdef IN_PLACE
+    if (parity == 1) {
+        // Odd steps only read the cell's own slots, where the populations sit reversed
+        for (int k = local_index; k < 16 * 16 * 9; k += 256) {
+#ifdef LAYOUT_SOA
+            int i = k / (16 * 16), local = k % (16 * 16);
+#else
+            int i = k % 9, local = k / 9;
+#endif
+            ivec2 cell = origin + ivec2(local % 16, local / 16);
+            tile_f[opp[i]][local] = readPop(POP(cell.y * width + cell.x, i), i);
+        }
+        return;
+    }
+#endif
+
+    // Only the values that stream into the work group are loaded, the same ones the untiled
+    // kernel reads; edge neighbors are left to the equilibrium boundary
+    for (int k = local_index; k < 18 * 18 * 9; k += 256) {
+#ifdef LAYOUT_SOA
+        int i = k / (18 * 18), halo = k % (18 * 18);
+#else
+        int i = k % 9, halo = k / 9;
+#endif
+        ivec2 src = origin - 1 + ivec2(halo % 18, halo / 18);
+        ivec2 dst = src + velocities[i] - origin;
+        if (all(greaterThanEqual(dst, ivec2(0))) && all(lessThan(dst, ivec2(16))) &&
+            src.x > 0 && src.x < width - 1 && src.y > 0 && src.y < height - 1) {
+            tile_f[i][dst.y * 16 + dst.x] = readPop(POP(src.y * width + src.x, i), i);
+        }
+    }
+}
+#endif
+
+// Where population i leaving the cell is stored
+int outSlot(ivec2 gid, int index, int i) {
+#ifdef IN_PLACE
+    if (parity == 0) {
+        ivec2 target = gid + velocities[i];
+        return POP(target.y * width + target.x, opp[i]);
+    }
+#endif
+    return POP(index, i);
+}
+
+// Pulls the populations streaming into the cell and collides them. Collision conserves density
+// and velocity, so the ones returned also hold for the populations stored.
+void streamCollide(ivec2 gid, int index, out float fo[9], out float density, out vec2 velocity) {
+    // Streaming step (pull from neighbors)
+    float f[9];
+    for (int i = 0; i < 9; i++) {
+        ivec2 neighborPos = gid - velocities[i];
+        if (neighborPos.x > 0 && neighborPos.x < width - 1 && neighborPos.y > 0 && neighborPos.y < height - 1) {
+            int neighborIndex = neighborPos.y * width + neighborPos.x;
+#if defined(TILED)
+            f[i] = tile_f[i][gl_LocalInvocationIndex];
+#elif defined(IN_PLACE)
+            f[i] = parity == 0 ? readPop(POP(neighborIndex, i), i)
+                               : readPop(POP(index, opp[i]), opp[i]);
+#else
+            f[i] = readPop(POP(neighborIndex, i), i);
+#endif
+        } else {
+            // Equilibrium boundaries, also for neighbors past the edge so that edge cells
+            // never read uninitialized values
+            f[i] = freestream(i);
+        }
+    }
+
+    // Compute density and velocity
+    density = 0.0;
+    velocity = vec2(0.0);
+    for (int i = 0; i < 9; i++) {
+        density += f[i];
+        velocity += f[i] * vec2(velocities[i]);
+    }
+    velocity /= density;
+
+    // Collision step
+    float feq[9];
+    for (int i = 0; i < 9; i++) {
+        float velDotC = dot(vec2(velocities[i]), velocity);
+        float velSq = dot(velocity, velocity);
+        feq[i] = weights[i] * density * (1.0 + 3.0 * velDotC + 4.5 * velDotC * velDotC - 1.5 * velSq);
+    }
+
+    // See Collision in Lattice.h for the operators and their rates
+    float omega = 1.0 / tau;
+#ifdef SMAGORINSKY
+    // Local tau of the Smagorinsky model, see Collide in CpuCollision.h
+    vec3 stress = vec3(0.0); // xx, yy, xy
+    for (int i = 0; i < 9; i++) {
+        vec2 c = vec2(velocities[i]);
+        stress += vec3(c.x * c.x, c.y * c.y, c.x * c.y) * (f[i] - feq[i]);
+    }
+    float q = sqrt(2.0 * dot(stress, stress * vec3(1.0, 1.0, 2.0)));
+    float c = 18.0 * SMAGORINSKY * SMAGORINSKY;
+    omega = 2.0 / (tau + sqrt(tau * tau + c * q / density));
+#endif
+#if defined(COLLISION_TRT)
+    for (int i = 0; i < 9; i++) {
+        int j = opp[i];
+        float even = 0.5 * (f[i] + f[j] - feq[i] - feq[j]);
+        float odd = 0.5 * (f[i] - f[j] - feq[i] + feq[j]);
+        fo[i] = f[i] - omega * even - HEAT_FLUX_RATE * odd;
+    }
+#elif defined(COLLISION_MRT)
+    // Relaxed moments of f - feq in the Lallemand and Luo basis, projected back
+    float rates[6] = float[6](MRT_RATE_E, MRT_RATE_EPS, HEAT_FLUX_RATE, HEAT_FLUX_RATE,
+                              omega, omega);
+    for (int i = 0; i < 9; i++) {
+        fo[i] = f[i];
+    }
+    for (int k = 0; k < 6; k++) {
+        float moment = 0.0;
+        for (int i = 0; i < 9; i++) {
+            moment += float(mrtBasis[k * 9 + i]) * (f[i] - feq[i]);
+        }
+        moment *= rates[k] / mrtNorms[k];
+        for (int i = 0; i < 9; i++) {
+            fo[i] -= float(mrtBasis[k * 9 + i]) * moment;
+        }
+    }
+#else
+    for (int i = 0; i < 9; i++) {
+        fo[i] = f[i] - (f[i] - feq[i]) * omega;
+    }
+#endif
+}
+
+#ifdef FP16
+shared float tile_out[9][16 * 16];
+
+// Two halves share a word, so the cell pairs (2k, 2k + 1) write their words whole: in SoA the
+// pair's word in each plane, in AoS the 9 words holding the pair's 18 halves. The even cell
+// writes the first 5, the odd cell the last 4. Pushes into the neighbors' slots on in place even
+// steps land in words other work groups also write, they are merged with atomics instead.
+void storeCell(ivec2 gid, int index, bool updated, float fo[9]) {
+#ifdef IN_PLACE
+    if (parity == 0) {
+        for (int i = 0; updated && i < 9; i++) {
+            int slot = outSlot(gid, index, i);
+            int shift = (slot & 1) * 16;
+            uint bits = packHalf2x16(vec2(fo[i] - weights[i], 0.0)) << shift;
+            atomicAnd(f_out[slot >> 1], ~(0xFFFFu << shift));
+            atomicOr(f_out[slot >> 1], bits);
+        }
+        return;
+    }
+#endif
+    int local = int(gl_LocalInvocationIndex);
+    for (int i = 0; i < 9; i++) {
+        tile_out[i][local] = fo[i];
+    }
+    barrier();
+
+    int pair_cell = index & ~1;
+    int pair_local = local & ~1;
+    for (int w = (gid.x & 1) * 5; w < 5 + (gid.x & 1) * 4; w++) {
+#ifdef LAYOUT_SOA
+        int i0 = w, i1 = w, c0 = 0, c1 = 1;
+#else
+        int i0 = (2 * w) % 9, i1 = (2 * w + 1) % 9, c0 = (2 * w) / 9, c1 = (2 * w + 1) / 9;
+#endif
+        vec2 pair = vec2(tile_out[i0][pair_local + c0] - weights[i0],
+                         tile_out[i1][pair_local + c1] - weights[i1]);
+        f_out[POP(pair_cell + c0, i0) >> 1] = packHalf2x16(pair);
+    }
+}
+#else
+void storeCell(ivec2 gid, int index, bool updated, float fo[9]) {
+    for (int i = 0; updated && i < 9; i++) {
+        f_out[outSlot(gid, index, i)] = fo[i];
+    }
+}
+#endif
+
+void main() {
+    ivec2 origin = tileOrigin();
+    ivec2 gid = origin + ivec2(gl_LocalInvocationID.xy);
+    int index = gid.y * width + gid.x;
+#ifdef SPARSE
+    bool quiescent = quiescent_pass != 0;
+#else
+    const bool quiescent = false;
+#endif
+
+#ifdef TILED
+    if (!quiescent) {
+        loadTile(origin);
+    }
+    barrier();
+    ivec2 local = ivec2(gl_LocalInvocationID.xy);
+    bool solid = ((tile_solid[local.y] >> local.x) & 1u) != 0u;
+#else
+    bool solid = isSolid(gid.x, gid.y);
+#endif
+
+    // No early returns, the tiled and FP16 variants synchronize the work group
+    float fo[9];
+    bool updated = true;
+    // Cells not collided here sit at the inflow state or at rest
+    float density = 1.0;
+    vec2 velocity = vec2(U0, 0.0);
+#ifdef IN_PLACE
+    // Nothing reads the edge cells, and their push targets may lie outside the grid. Their own
+    // slots are passed through for the word stores of FP16.
+    updated = gid.x > 0 && gid.x < width - 1 && gid.y > 0 && gid.y < height - 1;
+    if (!updated) {
+        for (int i = 0; i < 9; i++) {
+            fo[i] = readPop(POP(index, i), i);
+        }
+    } else if (quiescent) {
+        for (int i = 0; i < 9; i++) {
+            fo[i] = freestream(i);
+        }
+    } else if (solid) {
+        // Solid cells only ever swap their own rest state, so hand it out unchanged
+        fo = weights;
+    } else {
+        streamCollide(gid, index, fo, density, velocity);
+    }
+#else
+    if (quiescent) {
+        for (int i = 0; i < 9; i++) {
+            fo[i] = freestream(i);
+        }
+    } else if (solid) {
+        // Bounce-back boundary condition for solid
+        for (int i = 0; i < 9; i++) {
+            fo[i] = readPop(POP(index, opp[i]), opp[i]);
+        }
+    } else {
+        streamCollide(gid, index, fo, density, velocity);
+    }
+#endif
+    storeCell(gid, index, updated, fo);
+
+    if (write_fields != 0) {
+        // Quiescent tiles hold no solid cells, the tiled variant does not even load their bits
+        bool solid_cell = solid && !quiescent;
+        vec4 fields = solid_cell ? vec4(1.0, 0.0, 0.0, 1.0) : vec4(density, velocity, 0.0);
+        imageStore(fields_image, gid, fields);
+    }
+}
+)glsl";
+
+// Sparse scheduling, see GpuSolver::SetSparse. With CLASSIFY, one work group per tile flags it
+// from the populations after the last step; otherwise one invocation per tile sorts the flagged
+// tiles into the active and quiescent lists and their indirect dispatch arguments.
+inline const char* kTileShader = R"glsl(
+#version 460 core
+
+#ifdef CLASSIFY
+layout(local_size_x = 16, local_size_y = 16) in;
+#else
+layout(local_size_x = 64) in;
+#endif
+
+#ifdef FP16
+#define POP_TYPE uint
+#else
+#define POP_TYPE float
+#endif
+
+layout(std430, binding = 0) buffer DF_In {
+    POP_TYPE f_in[];
+};
+
+layout(std430, binding = 2) buffer SolidCells {
+    uint solid_bits[];
+};
+
+// 0 active, 1 at the freestream, 2 solid with a solid ring around it, which no fluid cell reads
+layout(std430, binding = 3) buffer TileFlags {
+    uint tile_flags[];
+};
+
+// Active tiles from 0 and quiescent ones from the tile count, num_groups_x counting them
+layout(std430, binding = 4) buffer TileLists {
+    uvec4 dispatch[2];
+    uint tile_list[];
+};
+
+layout(std140, binding = 0) uniform SimParams {
+    int width;
+    int height;
+    float U0;
+    float tau;
+    int plane_stride;
+};
+
+// Largest difference from the freestream equilibrium still counted as quiescent
+uniform float tolerance;
+
+#ifdef LAYOUT_SOA
+#define POP(cell, i) ((i) * plane_stride + (cell))
+#else
+#define POP(cell, i) ((cell) * 9 + (i))
+#endif
+
+const ivec2 velocities[9] = ivec2[9](
+    ivec2(-1, 1), ivec2(0, 1), ivec2(1, 1),
+    ivec2(-1, 0), ivec2(0, 0), ivec2(1, 0),
+    ivec2(-1, -1), ivec2(0, -1), ivec2(1, -1)
+);
+
+const float weights[9] = float[9](
+    1.0f/36, 1.0f/9, 1.0f/36,
+    1.0f/9, 4.0f/9, 1.0f/9,
+    1.0f/36, 1.0f/9, 1.0f/36
+);
+
+float readPop(int slot, int i) {
+#ifdef FP16
+    vec2 pair = unpackHalf2x16(f_in[slot >> 1]);
+    return ((slot & 1) == 0 ? pair.x : pair.y) + weights[i];
+#else
+    return f_in[slot];
+#endif
+}
+
+// Cells past the edge count as solid, nothing reads them either
+bool isSolid(ivec2 cell) {
+    if (cell.x < 0 || cell.x >= width || cell.y < 0 || cell.y >= height)
+        return true;
+    int bit_index = cell.y * width + cell.x;
+    return (solid_bits[bit_index / 32] & (1u << (bit_index % 32))) != 0u;
+}
+
+#ifdef CLASSIFY
+shared uint all_solid;
+shared uint all_quiet;
+
+void main() {
+    ivec2 tile = ivec2(gl_WorkGroupID.xy);
+    ivec2 gid = ivec2(gl_GlobalInvocationID.xy);
+    int local_index = int(gl_LocalInvocationIndex);
+    if (local_index == 0) {
+        all_solid = 1u;
+        all_quiet = 1u;
+    }
+    barrier();
+
+    // Sampled after an odd step in place, so every cell holds its own populations
+    bool solid = isSolid(gid);
+    bool quiet = !solid;
+    vec2 velocity = vec2(U0, 0.0);
+    for (int i = 0; i < 9 && quiet; i++) {
+        float velDotC = dot(vec2(velocities[i]), velocity);
+        float feq = weights[i] * (1.0 + 3.0 * velDotC + 4.5 * velDotC * velDotC -
+                                  1.5 * dot(velocity, velocity));
+        quiet = abs(readPop(POP(gid.y * width + gid.x, i), i) - feq) <= tolerance;
+    }
+
+    // The 68 cells ringing the tile, whose fluid cells would pull from it
+    if (local_index < 68) {
+        int side = local_index / 17, k = local_index % 17;
+        ivec2 ring = side == 0 ? ivec2(k - 1, -1) : side == 1 ? ivec2(16, k - 1)
+                   : side == 2 ? ivec2(k, 16) : ivec2(-1, k);
+        solid = solid && isSolid(tile * 16 + ring);
+    }
+
+    if (!solid)
+        atomicAnd(all_solid, 0u);
+    if (!quiet)
+        atomicAnd(all_quiet, 0u);
+    barrier();
+
+    if (local_index == 0) {
+        uint flag = all_solid != 0u ? 2u : all_quiet != 0u ? 1u : 0u;
+        tile_flags[tile.y * (width / 16) + tile.x] = flag;
+    }
+}
+#else
+void main() {
+    int tiles_x = width / 16;
+    int num_tiles = tiles_x * (height / 16);
+    int tile = int(gl_GlobalInvocationID.x);
+    if (tile >= num_tiles)
+        return;
+    uint flag = tile_flags[tile];
+    if (flag == 2u)
+        return;
+
+    // Disturbances travel one cell per step, so a tile is only left to the freestream when its
+    // 8 neighbors are at it too: that keeps it 16 steps away from anything else
+    ivec2 t = ivec2(tile % tiles_x, tile / tiles_x);
+    bool quiescent = flag == 1u;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            ivec2 n = t + ivec2(dx, dy);
+            if (n.x >= 0 && n.x < tiles_x && n.y >= 0 && n.y < height / 16 &&
+                tile_flags[n.y * tiles_x + n.x] != 1u)
+                quiescent = false;
+        }
+    }
+
+    int list = quiescent ? 1 : 0;
+    uint slot = atomicAdd(dispatch[list].x, 1u);
+    tile_list[list * num_tiles + int(slot)] = uint(tile);
+}
+#endif
+)glsl";
+
+// Momentum exchange on the obstacle, see GpuSolver::SetForceSampling. Without REDUCE, one
+// invocation per cell of the obstacle's bounding box sums over its links to solid neighbors and
+// each work group writes its partial sum; with REDUCE, a single work group adds up the partials
+// into one slot of the sample ring.
+inline const char* kForceShader = R"glsl(
+#version 460 core
+#extension GL_KHR_shader_subgroup_basic : enable
+#extension GL_KHR_shader_subgroup_arithmetic : enable
+
+#ifdef REDUCE
+layout(local_size_x = 256) in;
+#else
+layout(local_size_x = 16, local_size_y = 16) in;
+#endif
+
+#ifdef FP16
+#define POP_TYPE uint
+#else
+#define POP_TYPE float
+#endif
+
+layout(std430, binding = 0) buffer DF_In {
+    POP_TYPE f_in[];
+};
+
+layout(std430, binding = 2) buffer SolidCells {
+    uint solid_bits[];
+};
+
+layout(std430, binding = 5) buffer ForcePartials {
+    vec2 partials[];
+};
+
+// Force after each sampled step, in lattice units. With RESIDUAL, partials and samples hold
+// the sums of |u - u_prev|^2 and |u|^2 instead, see GpuSolver::SampleResidual.
+layout(std430, binding = 6) buffer ForceSamples {
+    vec2 samples[];
+};
+
+#ifdef RESIDUAL
+// Velocity of every cell at the previous residual sample, replaced by the current one
+layout(std430, binding = 7) buffer PreviousVelocity {
+    vec2 previous[];
+};
+#endif
+
+layout(std140, binding = 0) uniform SimParams {
+    int width;
+    int height;
+    float U0;
+    float tau;
+    int plane_stride;
+};
+
+#ifdef REDUCE
+uniform int num_partials;
+uniform int sample_slot;
+#elif defined(RESIDUAL)
+uniform int parity;
+#else
+// Lowest cell of the bounding box, one cell out from the solid cells
+uniform ivec2 box_origin;
+#endif
+
+#ifdef LAYOUT_SOA
+#define POP(cell, i) ((i) * plane_stride + (cell))
+#else
+#define POP(cell, i) ((cell) * 9 + (i))
+#endif
+
+const ivec2 velocities[9] = ivec2[9](
+    ivec2(-1, 1), ivec2(0, 1), ivec2(1, 1),
+    ivec2(-1, 0), ivec2(0, 0), ivec2(1, 0),
+    ivec2(-1, -1), ivec2(0, -1), ivec2(1, -1)
+);
+
+const float weights[9] = float[9](
+    1.0f/36, 1.0f/9, 1.0f/36,
+    1.0f/9, 4.0f/9, 1.0f/9,
+    1.0f/36, 1.0f/9, 1.0f/36
+);
+
+const int opp[9] = int[9](8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+float readPop(int slot, int i) {
+#ifdef FP16
+    vec2 pair = unpackHalf2x16(f_in[slot >> 1]);
+    return ((slot & 1) == 0 ? pair.x : pair.y) + weights[i];
+#else
+    return f_in[slot];
+#endif
+}
+
+bool isSolid(ivec2 cell) {
+    int bit_index = cell.y * width + cell.x;
+    return (solid_bits[bit_index / 32] & (1u << (bit_index % 32))) != 0u;
+}
+
+// Sum over the work group's 256 invocations, valid in invocation 0. Each subgroup adds up its
+// values in registers and only the subgroup sums go through shared memory; without subgroup
+// support, a tree reduction in shared memory.
+shared vec2 group_sums[256];
+
+vec2 groupSum(vec2 value) {
+    int local_index = int(gl_LocalInvocationIndex);
+#ifdef GL_KHR_shader_subgroup_arithmetic
+    value = subgroupAdd(value);
+    if (subgroupElect()) {
+        group_sums[gl_SubgroupID] = value;
+    }
+    barrier();
+    if (local_index == 0) {
+        for (uint k = 1u; k < gl_NumSubgroups; k++) {
+            value += group_sums[k];
+        }
+    }
+#else
+    group_sums[local_index] = value;
+    barrier();
+    for (int stride = 128; stride > 0; stride /= 2) {
+        if (local_index < stride) {
+            group_sums[local_index] += group_sums[local_index + stride];
+        }
+        barrier();
+    }
+    value = group_sums[0];
+#endif
+    return value;
+}
+
+#ifdef REDUCE
+void main() {
+    vec2 force = vec2(0.0);
+    for (int k = int(gl_LocalInvocationIndex); k < num_partials; k += 256) {
+        force += partials[k];
+    }
+    force = groupSum(force);
+    if (gl_LocalInvocationIndex == 0u) {
+        samples[sample_slot] = force;
+    }
+}
+#elif defined(RESIDUAL)
+void main() {
+    ivec2 cell = ivec2(gl_GlobalInvocationID.xy);
+    vec2 sums = vec2(0.0);
+    // Interior fluid cells, where in place populations can be read after either parity
+    if (cell.x > 0 && cell.x < width - 1 && cell.y > 0 && cell.y < height - 1 && !isSolid(cell)) {
+        int index = cell.y * width + cell.x;
+        float density = 0.0;
+        vec2 u = vec2(0.0);
+        for (int i = 0; i < 9; i++) {
+            // After an odd step, pushed into the neighbor's opposite slot, see CellMacroscopic
+            ivec2 target = parity == 1 ? cell + velocities[i] : cell;
+            int slot = parity == 1 ? opp[i] : i;
+            float fi = readPop(POP(target.y * width + target.x, slot), slot);
+            density += fi;
+            u += fi * vec2(velocities[i]);
+        }
+        u /= density;
+        vec2 du = u - previous[index];
+        sums = vec2(dot(du, du), dot(u, u));
+        previous[index] = u;
+    }
+    sums = groupSum(sums);
+    if (gl_LocalInvocationIndex == 0u) {
+        partials[gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x] = sums;
+    }
+}
+#else
+void main() {
+    ivec2 cell = box_origin + ivec2(gl_GlobalInvocationID.xy);
+    vec2 force = vec2(0.0);
+    // Edge cells are left to the equilibrium boundary and never bounce anything back
+    if (cell.x > 0 && cell.x < width - 1 && cell.y > 0 && cell.y < height - 1 && !isSolid(cell)) {
+        int index = cell.y * width + cell.x;
+        for (int i = 0; i < 9; i++) {
+            ivec2 wall = cell + velocities[i];
+            if (i == 4 || !isSolid(wall))
+                continue;
+            // The population leaving into the wall and the one the wall sends back over the same
+            // link. In place, after either parity, the pair sits in these two slots.
+            int wall_index = wall.y * width + wall.x;
+            float out_pop = readPop(POP(index, i), i);
+            float in_pop = readPop(POP(wall_index, opp[i]), opp[i]);
+            force += vec2(velocities[i]) * (out_pop + in_pop);
+        }
+    }
+    force = groupSum(force);
+    if (gl_LocalInvocationIndex == 0u) {
+        partials[gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x] = force;
+    }
+}
+#endif
+)glsl";
+
+inline const char* kFragmentShader = R"glsl(
+#version 460 core
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// Shared by all programs, see SimUniforms
+layout(std140, binding = 0) uniform SimParams {
+    int width;
+    int height;
+    float U0; // Inflow speed, also used to normalize the color scale
+    float tau;
+    int plane_stride;
+};
+
+// Density, velocity and solid flag written by the compute step, see GpuSolver::FieldsTexture
+uniform sampler2D fields;
+// Speed from 0 to U0 to color
+uniform sampler1D colormap;
+
+void main() {
+    ivec2 cell = ivec2(TexCoords * vec2(width, height));
+    if (cell.x >= width || cell.y >= height) {
+        FragColor = vec4(0.0);
+        return;
+    }
+
+    vec4 value = texelFetch(fields, cell, 0);
+    if (value.a != 0.0) {
+        FragColor = vec4(0.5, 0.5, 0.5, 1.0); // Gray for solid
+        return;
+    }
+
+    float speed = length(value.yz);
+    if (isinf(speed) || isnan(speed) || isinf(value.x)) {
+        FragColor = vec4(0.0, 0.0, 0.0, 1.0); // Black for invalid values
+        return;
+    }
+
+    FragColor = vec4(texture(colormap, clamp(speed / U0, 0.0, 1.0)).rgb, 1.0);
+}
+)glsl";
+
+inline const char* kVertexShader = R"glsl(
+#version 460 core
+
+layout(location = 0) in vec2 aPos;
+layout(location = 1) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    gl_Position = vec4(aPos, 0.0, 1.0);
+}
+)glsl";
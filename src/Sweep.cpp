@@ -0,0 +1,902 @@
+// Parameter sweep runner. Expands a sweep spec into cases, runs them on the GPU and on CPU workers
+// at the same time and writes one summary table of timing and force results.
+//
+//   cfd_sweep spec.txt [--backends cpu,gpu] [--cpu-workers N] [--threads-per-worker N]
+//             [--ensemble K] [--force-interval N] [--csv summary.csv]
+//
+// A spec is a list of `key = value, value, ...` lines, # starting a comment. Keys before the
+// first [sweep] line are defaults. Each [sweep] section adds the Cartesian product of the values
+// of every key, its own lines replacing the defaults; a spec without sections is the product of
+// its defaults. A list of cases is a list of sections with one value per key.
+//
+//   re            Reynolds number U0 L / nu, sets tau                    (100)
+//   u0            Inflow velocity in lattice units                       (0.075)
+//   length        Characteristic length L in cells, 0 for height / 4     (0)
+//   size          WxH, multiples of 16                                   (2048x512)
+//   geometry      wedge, or an .svg, .pgm or .png file                   (wedge)
+//   steps         Steps per case, at most with converge                  (10000)
+//   average_from  First step of the force averages, -1 for steps / 2     (-1)
+//   collision     bgk, trt or mrt                                        (bgk)
+//   smagorinsky   Smagorinsky constant, 0 without the LES model          (0)
+//   backend       cpu, gpu or any                                        (any)
+//   converge      on to stop at a steady or periodic state, or off          (on)
+//
+// Cases are queued by cells times steps. The GPU takes the largest case left and, while a GPU is
+// there, CPU workers take the smallest ones; without one they take the largest first. A CPU
+// worker packs up to --ensemble cases that share a grid, geometry, operator and step count into
+// one CpuEnsemble. Forces are sampled every step on the GPU and every --force-interval steps on
+// the CPU. A case whose sampled force (or on the CPU its center cell) stops being finite is
+// reported as diverged and, run alone, stopped.
+//
+// With converge, a ConvergenceMonitor follows the velocity residual and the lift coefficient of
+// each case: the case stops once the flow is steady, or once the shedding cycle repeats and a few
+// more cycles have been phase averaged, and its Cd and Cl are those of the converged state. An
+// ensemble runs until all its members have stopped. Periodic cases report their period and
+// Strouhal number L / (period U0).
+
+#include <glad/gl.h>
+#include <GLFW/glfw3.h>
+#pragma comment(lib, "glfw3.lib")
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Convergence.h"
+#include "CpuEnsemble.h"
+#include "CpuFeatures.h"
+#include "CpuSolver.h"
+#include "Geometry.h"
+#include "GeometryImport.h"
+#include "GpuSolver.h"
+#include "Lattice.h"
+#include "ThreadPool.h"
+
+struct SweepOptions
+{
+    const char* spec_path = nullptr;
+    std::vector<std::string> backends = {"cpu", "gpu"};
+    int cpu_workers = 0; // 0: hardware threads / threads_per_worker, less one with a GPU
+    int threads_per_worker = 1;
+    int ensemble = 16;       // Cases per CpuEnsemble at most, 1 runs each case alone
+    int force_interval = 10; // CPU steps between force samples
+    const char* csv_path = nullptr;
+};
+
+struct SweepCase
+{
+    float re;
+    float u0;
+    float length;
+    int width;
+    int height;
+    std::string geometry;
+    int steps;
+    int average_from;
+    Collision collision;
+    float smagorinsky;
+    std::string backend; // cpu, gpu or any
+    bool converge;
+
+    float Tau() const
+    {
+        return 3.0f * (u0 * length / re) + 0.5f;
+    }
+    // Force over the dynamic pressure on the characteristic length, as in the window
+    float ForceScale() const
+    {
+        return 1.0f / (0.5f * u0 * u0 * length);
+    }
+    double Work() const
+    {
+        return (double)width * height * steps;
+    }
+    // Cases with equal keys can share a CpuEnsemble
+    std::string EnsembleKey() const
+    {
+        char key[512];
+        snprintf(key, sizeof(key), "%dx%d %s %d %d %.9g %d", width, height, geometry.c_str(),
+                 steps, (int)collision, smagorinsky, (int)converge);
+        return key;
+    }
+};
+
+struct CaseResult
+{
+    std::string backend;
+    std::string kernel;
+    int members;    // Cases in the job that ran this one
+    double seconds; // Of that job
+    double mlups;   // Of that job, over all its members
+    int steps_run;
+    int samples;
+    double cd_mean;
+    double cl_mean;
+    double cl_stddev;
+    bool diverged;
+    ConvergenceState state; // Running when the case ran all its steps
+    double period;          // In steps, when periodic
+    double strouhal;
+};
+
+// Running force averages of one case, in coefficients
+struct ForceStats
+{
+    double sum_cd = 0.0;
+    double sum_cl = 0.0;
+    double sum_cl2 = 0.0;
+    int count = 0;
+
+    void Add(float cd, float cl)
+    {
+        sum_cd += cd;
+        sum_cl += cl;
+        sum_cl2 += (double)cl * cl;
+        count++;
+    }
+    void Finish(CaseResult* r) const
+    {
+        r->samples = count;
+        r->cd_mean = count > 0 ? sum_cd / count : 0.0;
+        r->cl_mean = count > 0 ? sum_cl / count : 0.0;
+        double var = count > 0 ? sum_cl2 / count - r->cl_mean * r->cl_mean : 0.0;
+        r->cl_stddev = sqrt(std::max(var, 0.0));
+    }
+};
+
+// Channels of the ConvergenceMonitor of a case, the tracked one first
+const int kLiftChannel = 0;
+const int kDragChannel = 1;
+
+// Replaces the force averages of r with those of the state monitor converged to, if it did
+static void FinishConverged(const SweepCase& c, const ConvergenceMonitor& monitor, CaseResult* r)
+{
+    r->state = monitor.State();
+    if (!monitor.Finished())
+        return;
+    r->steps_run = (int)monitor.StateStep();
+    r->cd_mean = monitor.Mean(kDragChannel);
+    r->cl_mean = monitor.Mean(kLiftChannel);
+    r->cl_stddev = 0.0;
+    if (monitor.State() != ConvergenceState::Periodic)
+        return;
+    // Spread of the phase averaged lift over one cycle
+    const std::vector<double> cycle = monitor.PhaseAverage(kLiftChannel);
+    double var = 0.0;
+    for (double cl : cycle)
+        var += (cl - r->cl_mean) * (cl - r->cl_mean) / cycle.size();
+    r->cl_stddev = sqrt(var);
+    r->period = monitor.Period();
+    r->strouhal = c.length / (r->period * c.u0);
+}
+
+static std::vector<std::string> Split(const std::string& list)
+{
+    std::vector<std::string> items;
+    size_t begin = 0;
+    while (begin <= list.size())
+    {
+        size_t end = std::min(list.find(',', begin), list.size());
+        std::string item = list.substr(begin, end - begin);
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t\r") + 1);
+        if (!item.empty())
+            items.push_back(item);
+        begin = end + 1;
+    }
+    return items;
+}
+
+// True when all of text is a number, which is then stored in value
+static bool ParseNumber(const std::string& text, int* value)
+{
+    char* end = nullptr;
+    const long parsed = strtol(text.c_str(), &end, 10);
+    if (end == text.c_str() || *end != '\0' || parsed < INT_MIN || parsed > INT_MAX)
+        return false;
+    *value = (int)parsed;
+    return true;
+}
+
+static bool ParseNumber(const std::string& text, float* value)
+{
+    char* end = nullptr;
+    *value = strtof(text.c_str(), &end);
+    return end != text.c_str() && *end == '\0' && isfinite(*value);
+}
+
+// In the order the products iterate, the first key varying slowest, and their defaults
+const char* kSpecKeys[] = {"geometry", "size",     "collision", "smagorinsky",
+                           "steps",    "average_from", "backend",   "converge",
+                           "length",   "re",       "u0"};
+const char* kSpecDefaults[] = {"wedge", "2048x512", "bgk", "0",   "10000", "-1",
+                               "any",   "on",       "0",   "100", "0.075"};
+const int kNumSpecKeys = sizeof(kSpecKeys) / sizeof(kSpecKeys[0]);
+
+using SpecValues = std::map<std::string, std::vector<std::string>>;
+
+static bool MakeCase(const std::map<std::string, std::string>& values, SweepCase* c)
+{
+    c->geometry = values.at("geometry");
+    c->backend = values.at("backend");
+    const std::string& converge = values.at("converge");
+    c->converge = converge == "on";
+    const std::string& collision = values.at("collision");
+    c->collision = collision == "mrt"   ? Collision::MRT
+                   : collision == "trt" ? Collision::TRT
+                                        : Collision::BGK;
+    const bool numbers = ParseNumber(values.at("smagorinsky"), &c->smagorinsky) &&
+                         ParseNumber(values.at("steps"), &c->steps) &&
+                         ParseNumber(values.at("average_from"), &c->average_from) &&
+                         ParseNumber(values.at("length"), &c->length) &&
+                         ParseNumber(values.at("re"), &c->re) &&
+                         ParseNumber(values.at("u0"), &c->u0);
+    const std::string& size = values.at("size");
+    if (sscanf(size.c_str(), "%dx%d", &c->width, &c->height) != 2 || c->width % 16 != 0 ||
+        c->height % 16 != 0 || c->width <= 0 || c->height <= 0)
+    {
+        printf("Bad size %s, expected WxH with multiples of 16\n", size.c_str());
+        return false;
+    }
+    if (!numbers || c->steps <= 0 || c->re <= 0.0f || c->u0 <= 0.0f || c->smagorinsky < 0.0f ||
+        (c->backend != "cpu" && c->backend != "gpu" && c->backend != "any") ||
+        (converge != "on" && converge != "off") ||
+        (collision != "bgk" && collision != "trt" && collision != "mrt"))
+    {
+        printf("Bad case: steps %s, average_from %s, length %s, re %s, u0 %s, smagorinsky %s, "
+               "backend %s, converge %s, collision %s\n",
+               values.at("steps").c_str(), values.at("average_from").c_str(),
+               values.at("length").c_str(), values.at("re").c_str(), values.at("u0").c_str(),
+               values.at("smagorinsky").c_str(), c->backend.c_str(), converge.c_str(),
+               collision.c_str());
+        return false;
+    }
+    if (c->length <= 0.0f)
+        c->length = c->height / 4.0f;
+    if (c->average_from < 0)
+        c->average_from = c->steps / 2;
+    if (c->Tau() <= 0.5f)
+    {
+        printf("Re %g is out of reach at U0 %g and L %g\n", c->re, c->u0, c->length);
+        return false;
+    }
+    return true;
+}
+
+// Appends the product of section over defaults to cases
+static bool ExpandSection(const SpecValues& defaults, const SpecValues& section,
+                          std::vector<SweepCase>* cases)
+{
+    std::vector<const std::vector<std::string>*> axes(kNumSpecKeys);
+    for (int k = 0; k < kNumSpecKeys; k++)
+    {
+        auto it = section.find(kSpecKeys[k]);
+        axes[k] = it != section.end() ? &it->second : &defaults.at(kSpecKeys[k]);
+    }
+    std::vector<size_t> digits(kNumSpecKeys, 0);
+    for (;;)
+    {
+        std::map<std::string, std::string> values;
+        for (int k = 0; k < kNumSpecKeys; k++)
+            values[kSpecKeys[k]] = (*axes[k])[digits[k]];
+        SweepCase c;
+        if (!MakeCase(values, &c))
+            return false;
+        cases->push_back(c);
+
+        int k = kNumSpecKeys - 1;
+        while (k >= 0 && ++digits[k] == axes[k]->size())
+            digits[k--] = 0;
+        if (k < 0)
+            return true;
+    }
+}
+
+static bool ReadSpec(const char* path, std::vector<SweepCase>* cases)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        printf("Cannot open %s\n", path);
+        return false;
+    }
+    SpecValues defaults;
+    for (int k = 0; k < kNumSpecKeys; k++)
+        defaults[kSpecKeys[k]] = {kSpecDefaults[k]};
+    std::vector<SpecValues> sections;
+    char line[4096];
+    bool ok = true;
+    for (int line_number = 1; ok && fgets(line, sizeof(line), file) != nullptr; line_number++)
+    {
+        std::string text = line;
+        text = text.substr(0, text.find('#'));
+        text.erase(0, text.find_first_not_of(" \t\r\n"));
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        if (text.empty())
+            continue;
+        if (text == "[sweep]")
+        {
+            sections.emplace_back();
+            continue;
+        }
+        size_t equals = text.find('=');
+        std::string key = text.substr(0, std::min(equals, text.size()));
+        key.erase(key.find_last_not_of(" \t") + 1);
+        std::vector<std::string> values;
+        if (equals != std::string::npos)
+            values = Split(text.substr(equals + 1));
+        bool known = false;
+        for (int k = 0; k < kNumSpecKeys; k++)
+            known = known || key == kSpecKeys[k];
+        if (!known || values.empty())
+        {
+            printf("%s:%d: expected one of the keys with a value, got \"%s\"\n", path, line_number,
+                   text.c_str());
+            ok = false;
+            break;
+        }
+        (sections.empty() ? defaults : sections.back())[key] = values;
+    }
+    fclose(file);
+    if (!ok)
+        return false;
+
+    if (sections.empty())
+        sections.emplace_back();
+    for (const SpecValues& section : sections)
+    {
+        if (!ExpandSection(defaults, section, cases))
+            return false;
+    }
+    return true;
+}
+
+// Cases not started yet, largest first, shared by the GPU and the CPU workers
+class CaseQueue
+{
+  public:
+    CaseQueue(const std::vector<SweepCase>& cases, bool gpu_available) : cases_(cases)
+    {
+        for (int i = 0; i < (int)cases.size(); i++)
+        {
+            if (gpu_available || cases[i].backend != "gpu")
+                pending_.push_back(i);
+        }
+        std::stable_sort(pending_.begin(), pending_.end(),
+                         [&](int a, int b) { return cases[a].Work() > cases[b].Work(); });
+        smallest_first_for_cpu_ = gpu_available;
+    }
+
+    // The GPU's next case, -1 when none is left for it
+    int TakeGpu()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t k = 0; k < pending_.size(); k++)
+        {
+            if (cases_[pending_[k]].backend != "cpu")
+                return Remove(k);
+        }
+        return -1;
+    }
+
+    // Up to max_members cases for one CPU job, empty when none is left
+    std::vector<int> TakeCpu(int max_members)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<int> job;
+        for (size_t n = 0; n < pending_.size(); n++)
+        {
+            size_t k = smallest_first_for_cpu_ ? pending_.size() - 1 - n : n;
+            if (cases_[pending_[k]].backend != "gpu")
+            {
+                job.push_back(Remove(k));
+                break;
+            }
+        }
+        if (job.empty())
+            return job;
+        const std::string key = cases_[job[0]].EnsembleKey();
+        for (size_t k = 0; k < pending_.size() && (int)job.size() < max_members;)
+        {
+            const SweepCase& c = cases_[pending_[k]];
+            if (c.backend != "gpu" && c.EnsembleKey() == key)
+                job.push_back(Remove(k));
+            else
+                k++;
+        }
+        return job;
+    }
+
+  private:
+    int Remove(size_t k)
+    {
+        int index = pending_[k];
+        pending_.erase(pending_.begin() + k);
+        return index;
+    }
+
+    const std::vector<SweepCase>& cases_;
+    std::mutex mutex_;
+    std::vector<int> pending_;
+    bool smallest_first_for_cpu_;
+};
+
+// Results in case order, and a line per finished case as they come in
+class ResultTable
+{
+  public:
+    explicit ResultTable(const std::vector<SweepCase>& cases)
+        : cases_(cases), results_(cases.size()), done_(cases.size(), false)
+    {
+    }
+
+    void Report(int index, const CaseResult& result)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        results_[index] = result;
+        done_[index] = true;
+        num_done_++;
+        const SweepCase& c = cases_[index];
+        std::string note;
+        if (result.diverged)
+            note = "  DIVERGED";
+        else if (result.state != ConvergenceState::Running)
+            note = std::string("  ") + ConvergenceStateName(result.state);
+        printf("[%d/%d] case %d: Re %g U0 %g %dx%d %s on %s %s  %.1f s  %d steps  Cd %.4f "
+               "Cl %.4f%s\n",
+               num_done_, (int)cases_.size(), index, c.re, c.u0, c.width, c.height,
+               c.geometry.c_str(), result.backend.c_str(), result.kernel.c_str(), result.seconds,
+               result.steps_run, result.cd_mean, result.cl_mean, note.c_str());
+        fflush(stdout);
+    }
+
+    const std::vector<CaseResult>& Results() const
+    {
+        return results_;
+    }
+    bool Done(int index) const
+    {
+        return done_[index];
+    }
+
+  private:
+    const std::vector<SweepCase>& cases_;
+    std::mutex mutex_;
+    std::vector<CaseResult> results_;
+    std::vector<bool> done_;
+    int num_done_ = 0;
+};
+
+static double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static SimParams CaseParams(const SweepCase& c)
+{
+    SimParams params = {c.width, c.height, c.u0, c.Tau(), Layout::SoA};
+    params.collision = c.collision;
+    params.smagorinsky = c.smagorinsky;
+    return params;
+}
+
+// Runs the cases of job, which share an EnsembleKey, alone on a CpuSolver or together on a
+// CpuEnsemble
+static void RunCpuJob(const std::vector<SweepCase>& cases, const std::vector<int>& job,
+                      const std::vector<uint32_t>& solid_cells, int force_interval,
+                      ThreadPool* pool, ResultTable* table)
+{
+    const SweepCase& first = cases[job[0]];
+    const int num_members = (int)job.size();
+    const int steps = first.steps;
+    std::vector<ForceStats> stats(num_members);
+    std::vector<bool> diverged(num_members, false);
+    std::vector<float> fx(num_members), fy(num_members);
+    std::vector<double> residuals(num_members);
+    const ConvergenceCriteria criteria;
+    std::vector<ConvergenceMonitor> monitors(num_members, ConvergenceMonitor(criteria, 2));
+    int steps_run = 0;
+    std::string kernel;
+
+    std::unique_ptr<CpuSolver> solver;
+    std::unique_ptr<CpuEnsemble> ensemble;
+    if (num_members == 1)
+    {
+        solver = std::make_unique<CpuSolver>(CaseParams(first), solid_cells, pool);
+        kernel = SimdLevelName(solver->GetSimdLevel());
+    }
+    else
+    {
+        std::vector<EnsembleMember> members;
+        for (int index : job)
+            members.push_back({cases[index].u0, cases[index].Tau()});
+        ensemble = std::make_unique<CpuEnsemble>(CaseParams(first), members, solid_cells, pool);
+        kernel = std::string(SimdLevelName(ensemble->GetSimdLevel())) + " x" +
+                 std::to_string(num_members);
+    }
+
+    const int cx = first.width / 2, cy = first.height / 2;
+    auto start = std::chrono::steady_clock::now();
+    while (steps_run < steps)
+    {
+        if (solver)
+            solver->Step();
+        else
+            ensemble->Step();
+        steps_run++;
+        if (first.converge && steps_run % criteria.check_interval == 0)
+        {
+            if (solver)
+                residuals[0] = solver->Residual();
+            else
+                ensemble->Residuals(residuals.data());
+            for (int k = 0; k < num_members; k++)
+                monitors[k].AddResidual(steps_run, residuals[k]);
+        }
+        if (steps_run % force_interval != 0 && steps_run != steps)
+            continue;
+
+        if (solver)
+            solver->Force(&fx[0], &fy[0]);
+        else
+            ensemble->Forces(fx.data(), fy.data());
+        int num_stopped = 0;
+        for (int k = 0; k < num_members; k++)
+        {
+            float density, ux, uy;
+            if (solver)
+                solver->Macroscopic(cx, cy, &density, &ux, &uy);
+            else
+                ensemble->Macroscopic(k, cx, cy, &density, &ux, &uy);
+            if (!isfinite(fx[k] + fy[k] + density + ux + uy))
+                diverged[k] = true;
+            const SweepCase& c = cases[job[k]];
+            const float coefficients[2] = {fy[k] * c.ForceScale(), fx[k] * c.ForceScale()};
+            if (!diverged[k] && steps_run >= c.average_from)
+                stats[k].Add(coefficients[kDragChannel], coefficients[kLiftChannel]);
+            if (!diverged[k] && c.converge)
+                monitors[k].AddSignal(steps_run, coefficients);
+            num_stopped += diverged[k] || (c.converge && monitors[k].Finished()) ? 1 : 0;
+        }
+        if (num_stopped == num_members)
+            break;
+    }
+    const double seconds = Seconds(start);
+
+    for (int k = 0; k < num_members; k++)
+    {
+        CaseResult r = {};
+        r.backend = "cpu";
+        r.kernel = kernel;
+        r.members = num_members;
+        r.seconds = seconds;
+        r.mlups = (double)steps_run * first.width * first.height * num_members / seconds / 1e6;
+        r.steps_run = steps_run;
+        r.diverged = diverged[k];
+        stats[k].Finish(&r);
+        if (!diverged[k])
+            FinishConverged(cases[job[k]], monitors[k], &r);
+        table->Report(job[k], r);
+    }
+}
+
+static void RunGpuCase(const SweepCase& c, int index, const std::vector<uint32_t>& solid_cells,
+                       ResultTable* table)
+{
+    const SimParams params = CaseParams(c);
+    const PopulationLayout layout(params);
+    std::vector<uint8_t> f_init(layout.Bytes());
+    InitPopulations(f_init.data(), solid_cells.data(), params, 0, params.height);
+    GpuSolver gpu(params, solid_cells, f_init.data());
+
+    // One residual sample per batch
+    const ConvergenceCriteria criteria;
+    const int batch = criteria.check_interval;
+    ForceStats stats;
+    ConvergenceMonitor monitor(criteria, 2);
+    bool diverged = false;
+    std::vector<ForceSample> samples;
+    std::vector<ResidualSample> residuals;
+    auto start = std::chrono::steady_clock::now();
+    int steps_run = 0;
+    while (steps_run < c.steps && !diverged && !monitor.Finished())
+    {
+        // Sampling starts with the first batch that reaches average_from, or right away to
+        // follow the lift
+        int count = std::min(batch, c.steps - steps_run);
+        gpu.SetForceSampling(c.converge || steps_run + count >= c.average_from);
+        gpu.Step(count);
+        steps_run += count;
+        if (c.converge)
+            gpu.SampleResidual();
+        if (steps_run == c.steps)
+            glFinish();
+        samples.clear();
+        gpu.PollForces(&samples);
+        for (const ForceSample& sample : samples)
+        {
+            const float coefficients[2] = {sample.fy * c.ForceScale(),
+                                           sample.fx * c.ForceScale()};
+            if (!isfinite(sample.fx + sample.fy))
+                diverged = true;
+            else if ((int)sample.step >= c.average_from)
+                stats.Add(coefficients[kDragChannel], coefficients[kLiftChannel]);
+            if (!diverged && c.converge)
+                monitor.AddSignal(sample.step, coefficients);
+        }
+        // Residuals lag the steps by a batch or so, the monitor only needs them in order
+        residuals.clear();
+        gpu.PollResiduals(&residuals);
+        for (const ResidualSample& sample : residuals)
+            monitor.AddResidual(sample.step, sample.residual);
+    }
+    glFinish();
+    const double seconds = Seconds(start);
+
+    CaseResult r = {};
+    r.backend = "gpu";
+    r.kernel = GpuKernelName(gpu.GetKernel());
+    r.members = 1;
+    r.seconds = seconds;
+    r.mlups = (double)steps_run * c.width * c.height / seconds / 1e6;
+    r.steps_run = steps_run;
+    r.diverged = diverged;
+    stats.Finish(&r);
+    if (!diverged)
+        FinishConverged(c, monitor, &r);
+    table->Report(index, r);
+}
+
+// value as a non-negative integer, false after reporting it when it is anything else
+static bool ParseCount(const char* option, const char* value, int* count)
+{
+    if (!ParseNumber(value, count) || *count < 0)
+    {
+        printf("Bad %s value %s, expected a non-negative integer\n", option, value);
+        return false;
+    }
+    return true;
+}
+
+static bool ParseOptions(int argc, char** argv, SweepOptions* options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (arg[0] != '-')
+        {
+            options->spec_path = arg;
+            continue;
+        }
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr)
+        {
+            printf("Missing value for %s\n", arg);
+            return false;
+        }
+        i++;
+
+        if (strcmp(arg, "--backends") == 0)
+            options->backends = Split(value);
+        else if (strcmp(arg, "--cpu-workers") == 0)
+        {
+            if (!ParseCount(arg, value, &options->cpu_workers))
+                return false;
+        }
+        else if (strcmp(arg, "--threads-per-worker") == 0)
+        {
+            if (!ParseCount(arg, value, &options->threads_per_worker))
+                return false;
+        }
+        else if (strcmp(arg, "--ensemble") == 0)
+        {
+            if (!ParseCount(arg, value, &options->ensemble))
+                return false;
+        }
+        else if (strcmp(arg, "--force-interval") == 0)
+        {
+            if (!ParseCount(arg, value, &options->force_interval))
+                return false;
+        }
+        else if (strcmp(arg, "--csv") == 0)
+            options->csv_path = value;
+        else
+        {
+            printf("Unknown option %s\n", arg);
+            return false;
+        }
+    }
+    return options->spec_path != nullptr && options->threads_per_worker > 0 &&
+           options->ensemble > 0 && options->force_interval > 0;
+}
+
+static GLFWwindow* CreateGLContext()
+{
+    if (!glfwInit())
+        return nullptr;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "cfd_sweep", nullptr, nullptr);
+    if (window == nullptr)
+        return nullptr;
+    glfwMakeContextCurrent(window);
+    if (gladLoadGL(glfwGetProcAddress) == 0)
+    {
+        glfwDestroyWindow(window);
+        return nullptr;
+    }
+    return window;
+}
+
+static void PrintSummary(const std::vector<SweepCase>& cases, const ResultTable& table, FILE* file,
+                         bool csv)
+{
+    if (csv)
+        fprintf(file, "case,re,u0,length,width,height,geometry,collision,smagorinsky,steps,tau,"
+                      "converge,backend,kernel,members,seconds,mlups,steps_run,samples,cd_mean,"
+                      "cl_mean,cl_stddev,diverged,state,period,strouhal\n");
+    else
+        fprintf(file,
+                "%4s %9s %6s %6s %11s %-12s %-3s %5s %7s %-4s %-12s %9s %8s %8s %8s %8s %-9s "
+                "%8s %6s\n",
+                "case", "Re", "U0", "L", "size", "geometry", "op", "Cs", "steps", "on", "kernel",
+                "seconds", "MLUPS", "Cd", "Cl", "Cl std", "state", "period", "St");
+    for (size_t i = 0; i < cases.size(); i++)
+    {
+        if (!table.Done((int)i))
+            continue;
+        const SweepCase& c = cases[i];
+        const CaseResult& r = table.Results()[i];
+        const char* state = r.diverged     ? "diverged"
+                            : !c.converge ? "-"
+                                          : ConvergenceStateName(r.state);
+        if (csv)
+            fprintf(file,
+                    "%d,%g,%g,%g,%d,%d,\"%s\",%s,%g,%d,%.6f,%d,%s,%s,%d,%.3f,%.3f,%d,%d,%.6f,"
+                    "%.6f,%.6f,%d,%s,%.3f,%.6f\n",
+                    (int)i, c.re, c.u0, c.length, c.width, c.height, c.geometry.c_str(),
+                    CollisionName(c.collision), c.smagorinsky, c.steps, c.Tau(), c.converge ? 1 : 0,
+                    r.backend.c_str(), r.kernel.c_str(), r.members, r.seconds, r.mlups,
+                    r.steps_run, r.samples, r.cd_mean, r.cl_mean, r.cl_stddev, r.diverged ? 1 : 0,
+                    state, r.period, r.strouhal);
+        else
+            fprintf(file,
+                    "%4d %9g %6g %6g %5dx%-5d %-12.12s %-3s %5g %7d %-4s %-12s %9.1f %8.1f %8.4f "
+                    "%8.4f %8.4f %-9s %8.1f %6.4f\n",
+                    (int)i, c.re, c.u0, c.length, c.width, c.height, c.geometry.c_str(),
+                    CollisionName(c.collision), c.smagorinsky, r.steps_run, r.backend.c_str(),
+                    r.kernel.c_str(), r.seconds, r.mlups, r.cd_mean, r.cl_mean, r.cl_stddev,
+                    state, r.period, r.strouhal);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    SweepOptions options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        printf("Usage: cfd_sweep spec.txt [--backends cpu,gpu] [--cpu-workers N] "
+               "[--threads-per-worker N] [--ensemble K] [--force-interval N] [--csv path]\n");
+        return 1;
+    }
+    std::vector<SweepCase> cases;
+    if (!ReadSpec(options.spec_path, &cases))
+        return 1;
+
+    bool want_gpu = std::find(options.backends.begin(), options.backends.end(), "gpu") !=
+                    options.backends.end();
+    bool want_cpu = std::find(options.backends.begin(), options.backends.end(), "cpu") !=
+                    options.backends.end();
+    GLFWwindow* window = want_gpu ? CreateGLContext() : nullptr;
+    if (want_gpu && window == nullptr)
+        printf("No GL 4.6 context, running on the CPU only\n");
+    if (window != nullptr)
+        printf("GPU: %s\n", (const char*)glGetString(GL_RENDERER));
+    const int hardware_threads = (int)std::max(std::thread::hardware_concurrency(), 1u);
+    const int cpu_workers =
+        !want_cpu ? 0
+        : options.cpu_workers > 0
+            ? options.cpu_workers
+            : std::max(hardware_threads / options.threads_per_worker - (window != nullptr), 1);
+    // The ensemble kernel's vector width, padding lanes would only cost time
+    const int max_members =
+        std::min(options.ensemble, EnsembleLaneWidth(SelectSimdLevel(SimdLevel::AVX512,
+                                                                     Layout::SoA)));
+    printf("%d cases, CPU: %s, %d workers of %d threads, up to %d cases per ensemble\n",
+           (int)cases.size(), SimdLevelName(DetectSimdLevel()), cpu_workers,
+           options.threads_per_worker, max_members);
+
+    // Every geometry is rasterized once per grid size, up front
+    ThreadPool setup_pool;
+    std::map<std::string, std::vector<uint32_t>> masks;
+    for (const SweepCase& c : cases)
+    {
+        const std::string key = c.geometry + "@" + std::to_string(c.width) + "x" +
+                                std::to_string(c.height);
+        if (masks.count(key) != 0)
+            continue;
+        std::vector<uint32_t>& solid_cells = masks[key];
+        if (c.geometry == "wedge")
+            solid_cells = WedgeMask(c.width, c.height, setup_pool);
+        else if (!LoadGeometryMask(c.geometry.c_str(), c.width, c.height, setup_pool, "mask_cache",
+                                   &solid_cells))
+            return 1;
+    }
+    auto Mask = [&](const SweepCase& c) -> const std::vector<uint32_t>& {
+        return masks.at(c.geometry + "@" + std::to_string(c.width) + "x" +
+                        std::to_string(c.height));
+    };
+
+    CaseQueue queue(cases, window != nullptr);
+    ResultTable table(cases);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int w = 0; w < cpu_workers; w++)
+    {
+        workers.emplace_back([&]() {
+            // Several pools share the machine, so none of them pins
+            ThreadPool pool(options.threads_per_worker, false);
+            for (;;)
+            {
+                std::vector<int> job = queue.TakeCpu(max_members);
+                if (job.empty())
+                    break;
+                RunCpuJob(cases, job, Mask(cases[job[0]]), options.force_interval, &pool,
+                          &table);
+            }
+        });
+    }
+    // GL calls stay on the thread that made the context
+    if (window != nullptr)
+    {
+        for (int index = queue.TakeGpu(); index >= 0; index = queue.TakeGpu())
+            RunGpuCase(cases[index], index, Mask(cases[index]), &table);
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    const double seconds = Seconds(start);
+
+    printf("\n");
+    PrintSummary(cases, table, stdout, false);
+    int num_done = 0;
+    for (size_t i = 0; i < cases.size(); i++)
+        num_done += table.Done((int)i) ? 1 : 0;
+    if (num_done < (int)cases.size())
+        printf("%d cases had no backend to run on\n", (int)cases.size() - num_done);
+    printf("%d cases in %.1f s, %.1f cases per hour\n", num_done, seconds,
+           num_done * 3600.0 / seconds);
+    if (options.csv_path != nullptr)
+    {
+        FILE* file = fopen(options.csv_path, "w");
+        if (file == nullptr)
+        {
+            printf("Cannot write %s\n", options.csv_path);
+        }
+        else
+        {
+            PrintSummary(cases, table, file, true);
+            fclose(file);
+            printf("Wrote %s\n", options.csv_path);
+        }
+    }
+
+    if (window != nullptr)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+    return num_done == (int)cases.size() ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+#include "ThreadPool.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Pins thread to the logical processor with the given system-wide index
+static void PinThread(std::thread& thread, int processor)
+{
+#if defined(_WIN32)
+    // Processors are split into groups of up to 64 on large machines
+    WORD num_groups = GetActiveProcessorGroupCount();
+    for (WORD group = 0; group < num_groups; group++)
+    {
+        int group_size = (int)GetActiveProcessorCount(group);
+        if (processor < group_size)
+        {
+            GROUP_AFFINITY affinity = {};
+            affinity.Group = group;
+            affinity.Mask = (KAFFINITY)1 << processor;
+            SetThreadGroupAffinity(thread.native_handle(), &affinity, nullptr);
+            return;
+        }
+        processor -= group_size;
+    }
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(processor, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+}
+
+ThreadPool::ThreadPool(int num_threads, bool pin)
+{
+    if (num_threads <= 0)
+        num_threads = (int)std::thread::hardware_concurrency();
+    num_threads_ = num_threads > 0 ? num_threads : 1;
+    queues_.reset(new Queue[num_threads_]);
+
+    for (int t = 1; t < num_threads_; t++)
+    {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, t);
+        if (pin)
+            PinThread(workers_.back(), t);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (std::thread& worker : workers_)
+        worker.join();
+}
+
+void ThreadPool::Run(int count, BandFn fn, void* context)
+{
+    if (count <= 0)
+        return;
+    if (num_threads_ == 1)
+    {
+        fn(context, 0, count);
+        return;
+    }
+
+    // A few bands per thread leaves something to steal when the load is uneven (solid cells,
+    // a busy core) while keeping each band a contiguous run of rows.
+    fn_ = fn;
+    context_ = context;
+    count_ = count;
+    num_bands_ = count < num_threads_ * 4 ? count : num_threads_ * 4;
+    for (int t = 0; t < num_threads_; t++)
+    {
+        queues_[t].next.store(t * num_bands_ / num_threads_, std::memory_order_relaxed);
+        queues_[t].end = (t + 1) * num_bands_ / num_threads_;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = num_threads_ - 1;
+        generation_++;
+    }
+    start_cv_.notify_all();
+
+    RunBands(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void ThreadPool::RunBands(int thread_index)
+{
+    // Own bands first, in order, then steal from the following threads
+    for (int k = 0; k < num_threads_; k++)
+    {
+        Queue& queue = queues_[(thread_index + k) % num_threads_];
+        for (;;)
+        {
+            int band = queue.next.fetch_add(1, std::memory_order_relaxed);
+            if (band >= queue.end)
+                break;
+            int begin = (int)((long long)band * count_ / num_bands_);
+            int end = (int)((long long)(band + 1) * count_ / num_bands_);
+            fn_(context_, begin, end);
+        }
+    }
+}
+
+void ThreadPool::WorkerLoop(int thread_index)
+{
+    uint64_t seen_generation = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_cv_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+            if (stop_)
+                return;
+            seen_generation = generation_;
+        }
+
+        RunBands(thread_index);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            last = --pending_ == 0;
+        }
+        if (last)
+            done_cv_.notify_one();
+    }
+}
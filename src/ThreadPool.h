@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Persistent worker threads for banded loops. ParallelFor splits [0, count) into contiguous
+// bands and gives each thread a fixed run of bands, so repeated calls with the same count touch
+// the same memory from the same thread (first touch then places pages on that thread's NUMA
+// node). A thread that runs out of bands steals the remaining ones of the others.
+class ThreadPool
+{
+  public:
+    // num_threads <= 0 uses every hardware thread. Workers are pinned one per logical processor
+    // if pin is set; the calling thread takes part as thread 0 and is left unpinned.
+    explicit ThreadPool(int num_threads = 0, bool pin = true);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int NumThreads() const
+    {
+        return num_threads_;
+    }
+
+    // Calls fn(begin, end) over disjoint bands covering [0, count) and returns when all are done
+    template <class Fn> void ParallelFor(int count, Fn&& fn)
+    {
+        using Callable = std::remove_reference_t<Fn>;
+        Run(count, [](void* context, int begin, int end) { (*(Callable*)context)(begin, end); }, &fn);
+    }
+
+  private:
+    using BandFn = void (*)(void* context, int begin, int end);
+
+    // Bands owned by one thread, on their own cache line
+    struct alignas(64) Queue
+    {
+        std::atomic<int> next;
+        int end;
+    };
+
+    void Run(int count, BandFn fn, void* context);
+    void RunBands(int thread_index);
+    void WorkerLoop(int thread_index);
+
+    int num_threads_;
+    std::vector<std::thread> workers_;
+    std::unique_ptr<Queue[]> queues_;
+
+    // Current job
+    BandFn fn_ = nullptr;
+    void* context_ = nullptr;
+    int count_ = 0;
+    int num_bands_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    uint64_t generation_ = 0;
+    int pending_ = 0; // Workers still running the current job
+    bool stop_ = false;
+};